@@ -2,7 +2,7 @@
 #include <cmath>
 
 
-static const int MAX_N = 100;
+static const int MAX_N = CU2QU_MAX_N;
 static const double MAX_ERR = 5.;
 static const double _2_3 = 2.0 / 3.0;
 static const double _27 = 1.0 / 27.0;
@@ -6,5 +6,8 @@
 using point_type = std::complex<double>;
 using point_type_vector = std::vector<point_type>;
 
+//most quadratic curves a cubic is split into
+constexpr int CU2QU_MAX_N = 100;
+
 bool curve_to_quadratic(const point_type_vector & ctl_points,
                         point_type_vector & spline_points);
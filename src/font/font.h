@@ -1,9 +1,11 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "glyph.h"
+#include "glyph_table.h"
 
 namespace ftdgl {
 
@@ -14,9 +16,25 @@ public:
 
 public:
     virtual bool IsSameFont(const std::string & desc) = 0;
+    //the description the font was created from, fonts created from a
+    //file or memory get one naming the file or blob, face index and size
+    virtual const std::string & GetDesc() const = 0;
     virtual GlyphPtr LoadGlyph(uint32_t codepoint) = 0;
+    //load the glyph into the glyph table if needed, return its id
+    //or INVALID_GLYPH_ID, cheaper than LoadGlyph for layout
+    virtual uint32_t LoadGlyphId(uint32_t codepoint) = 0;
+    //whether the font or a fallback has a glyph for codepoint, the
+    //load functions give chars without one the missing glyph
+    virtual bool HasGlyph(uint32_t codepoint) = 0;
+    //lookup with Find first and call LoadGlyphId on a miss
+    virtual const glyph_table_s & GetGlyphTable() const = 0;
     virtual bool LoadGlyphs(std::vector<uint32_t> codepoints,
                             Glyphs & glyphs) = 0;
+    //horizontal advance without loading the glyph outline, 0 if the
+    //glyph can not be loaded
+    virtual float GetAdvance(uint32_t codepoint) = 0;
+    //width of the widest line in text, only uses GetAdvance
+    virtual double MeasureText(const wchar_t * text, size_t length) = 0;
     virtual int GetPtSize() const = 0;
     virtual float GetDescender() const = 0;
     virtual float GetAscender() const = 0;
@@ -1,7 +1,7 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_STROKER_H
-// #include FT_ADVANCES_H
+#include FT_ADVANCES_H
 #include FT_LCD_FILTER_H
 
 #include "memory_buffer.h"
@@ -9,11 +9,19 @@
 #include "glyph_impl.h"
 #include "err_msg.h"
 
+#ifdef USE_FONTCONFIG
 #include <fontconfig/fontconfig.h>
+#endif
 #include <iostream>
 #include <algorithm>
 #include <stdio.h>
 #include <math.h>
+#include <cmath>
+#include <limits>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <sys/stat.h>
 
 namespace ftdgl {
 namespace impl {
@@ -21,6 +29,9 @@ namespace impl {
 #define HRES  64
 #define HRESf 64.f
 
+//advances are measured with the same flags so they match the loaded glyphs
+static const FT_Int32 GLYPH_LOAD_FLAGS = /*FT_LOAD_NO_SCALE |*/ FT_LOAD_NO_BITMAP | FT_LOAD_FORCE_AUTOHINT | FT_LOAD_TARGET_LCD;
+
 struct font_desc_s;
 
 struct internal_font_s {
@@ -30,10 +41,17 @@ struct internal_font_s {
 
     FT_Face m_Face;
 
+    //identify the face and its compile settings in a shared glyph store,
+    //set on first use of the store
+    uint64_t m_FileHash;
+    uint64_t m_CompileHash;
+    bool m_SharedKeyInited;
+
     bool m_Initialized;
 
     internal_font_s()
-        : m_Initialized {false} {
+        : m_SharedKeyInited {false}
+        , m_Initialized {false} {
     }
 
     ~internal_font_s() {
@@ -52,11 +70,15 @@ struct font_desc_s {
     bool underline;
     bool force_bold;
     int index;
+    //font file in memory used instead of file_name, not owned
+    const uint8_t * blob {nullptr};
+    size_t blob_size {0};
 
     internal_font_s internal_font;
 
     bool operator == (const font_desc_s & v) {
         return file_name == v.file_name
+                && blob == v.blob
                 && size == v.size
                 && bold == v.bold
                 && force_bold == v.force_bold
@@ -68,21 +90,75 @@ struct font_desc_s {
     }
 };
 
-using font_desc_vector = std::vector<font_desc_s>;
+//a deque so adding a fallback does not copy the faces already loaded
+using font_desc_vector = std::deque<font_desc_s>;
+
+//advances of glyphs measured but not loaded, same pages as the glyph
+//table, NaN when not measured yet, written under the font lock
+struct advance_cache_s {
+    using page_ptr = std::atomic<float> *;
+
+    std::vector<std::atomic<page_ptr>> pages;
+
+    advance_cache_s()
+        : pages(glyph_table_s::PAGE_COUNT) {
+        for(auto & p : pages)
+            p.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~advance_cache_s() {
+        for(auto & p : pages)
+            delete [] p.load(std::memory_order_relaxed);
+    }
+
+    float Find(uint32_t cp) const {
+        page_ptr page = pages[cp >> glyph_table_s::PAGE_BITS].load(std::memory_order_acquire);
+
+        return page
+                ? page[cp & (glyph_table_s::PAGE_SIZE - 1)].load(std::memory_order_relaxed)
+                : std::numeric_limits<float>::quiet_NaN();
+    }
+
+    void Add(uint32_t cp, float advance) {
+        page_ptr page = pages[cp >> glyph_table_s::PAGE_BITS].load(std::memory_order_relaxed);
+
+        if (!page) {
+            page = new std::atomic<float>[glyph_table_s::PAGE_SIZE];
+
+            for(uint32_t i = 0; i < glyph_table_s::PAGE_SIZE; i++)
+                page[i].store(std::numeric_limits<float>::quiet_NaN(), std::memory_order_relaxed);
+
+            pages[cp >> glyph_table_s::PAGE_BITS].store(page, std::memory_order_release);
+        }
+
+        page[cp & (glyph_table_s::PAGE_SIZE - 1)].store(advance, std::memory_order_relaxed);
+    }
+};
 
 class FontImpl : public Font {
 public:
     FontImpl(util::MemoryBufferPtr mem_buf, FT_Library & library,
+             std::recursive_mutex & lock,
+             const std::string & desc,
              const font_desc_s & font_desc,
-             const font_desc_vector & font_descs, float dpi, float dpi_height)
+             const font_desc_vector & font_descs, float dpi, float dpi_height,
+             GlyphPackPtr pack,
+             SharedGlyphStorePtr store)
         : m_FontFaceInitialized {false}
+        , m_Desc {desc}
         , m_FontDesc {font_desc}
         , m_FontDescs {font_descs}
         , m_Library {library}
+        , m_Lock (lock)
         , m_MemoryBuffer {mem_buf}
+        , m_GlyphTable {}
         , m_Glyphs {}
+        , m_Advances {}
         , m_Dpi {dpi}
         , m_DpiHeight {dpi_height}
+        , m_Pack {pack}
+        , m_PackFont {pack ? pack->FindFont(desc, dpi, dpi_height) : nullptr}
+        , m_GlyphStore {store}
     {
         InitFont();
     }
@@ -94,9 +170,19 @@ public:
 
 public:
     virtual bool IsSameFont(const std::string & desc);
+    virtual const std::string & GetDesc() const {
+        return m_Desc;
+    }
     virtual GlyphPtr LoadGlyph(uint32_t codepoint);
+    virtual uint32_t LoadGlyphId(uint32_t codepoint);
+    virtual bool HasGlyph(uint32_t codepoint);
+    virtual const glyph_table_s & GetGlyphTable() const {
+        return m_GlyphTable;
+    }
     virtual bool LoadGlyphs(std::vector<uint32_t> codepoints,
                             Glyphs & glyphs);
+    virtual float GetAdvance(uint32_t codepoint);
+    virtual double MeasureText(const wchar_t * text, size_t length);
     virtual int GetPtSize() const {
         return m_FontDesc.size;
     }
@@ -113,22 +199,47 @@ public:
         return m_FontDesc.internal_font.m_Height;
     }
 
+    bool IsLoaded() const {
+        return m_FontDesc.internal_font.m_Initialized;
+    }
+
+    void AddFallback(const FontImpl & fallback);
+
 private:
     void InitFont();
     void FreeFont();
+    //font_desc is the font the index belongs to, false when no font has
+    //the char and index is the missing glyph of the font itself
+    bool FindGlyphIndex(uint32_t codepoint, font_desc_s *& font_desc, FT_UInt & index);
+    float LoadAdvance(uint32_t codepoint);
+    //index of codepoint in the pack font or false
+    bool FindPacked(uint32_t codepoint, uint32_t & index) const;
+    void InitSharedKey(font_desc_s & font_desc);
 
     bool m_FontFaceInitialized;
+    std::string m_Desc;
     font_desc_s m_FontDesc;
     font_desc_vector m_FontDescs;
 
     FT_Library & m_Library;
+    std::recursive_mutex & m_Lock;
     util::MemoryBufferPtr m_MemoryBuffer;
 
-    Glyphs m_Glyphs;
+    glyph_table_s m_GlyphTable;
+    //indexed by glyph id, only for the GlyphPtr api
+    std::vector<GlyphPtr> m_Glyphs;
+    advance_cache_s m_Advances;
     float m_Dpi;
     float m_DpiHeight;
+
+    //precompiled glyphs served before compiling, the pack keeps the
+    //geometry mapped
+    GlyphPackPtr m_Pack;
+    const glyph_pack_font_s * m_PackFont;
+    SharedGlyphStorePtr m_GlyphStore;
 };
 
+#ifdef USE_FONTCONFIG
 static
 FcResult create_font_desc(FcResult result, const std::string& description,
                           FcPattern* match, font_desc_s& fd) {
@@ -164,11 +275,19 @@ FcResult create_font_desc(FcResult result, const std::string& description,
 	return result;
 #undef GET_VALUE
 }
+#endif
 
 static
 bool
 match_description(const std::string & description, font_desc_vector & font_descs )
 {
+#ifndef USE_FONTCONFIG
+    (void)font_descs;
+    std::cerr << "built without fontconfig, could not match description "
+              << description
+              << std::endl;
+    return false;
+#else
 
 #if (defined(_WIN32) || defined(_WIN64)) && !defined(__MINGW32__)
     std::cerr << "match_description not implemented for windows."
@@ -219,12 +338,16 @@ match_description(const std::string & description, font_desc_vector & font_descs
     FcFontSetDestroy(fontset);
     FcPatternDestroy(pattern);
     return font_descs.size() > 0;
+#endif
 }
 
 FontPtr CreateFontFromDesc(util::MemoryBufferPtr memory_buffer,
                            FT_Library & library,
+                           std::recursive_mutex & lock,
                            const std::string & desc,
-                           float dpi, float dpi_height) {
+                           float dpi, float dpi_height,
+                           GlyphPackPtr pack,
+                           SharedGlyphStorePtr store) {
     font_desc_vector fdv {};
 
     if (!match_description(desc, fdv)) {
@@ -234,7 +357,46 @@ FontPtr CreateFontFromDesc(util::MemoryBufferPtr memory_buffer,
         return FontPtr {};
     }
 
-    return std::make_shared<FontImpl>(memory_buffer, library, fdv[0], fdv, dpi, dpi_height);
+    return std::make_shared<FontImpl>(memory_buffer, library, lock, desc, fdv[0], fdv, dpi, dpi_height, pack, store);
+}
+
+FontPtr CreateFontFromFile(util::MemoryBufferPtr memory_buffer,
+                           FT_Library & library,
+                           std::recursive_mutex & lock,
+                           const std::string & desc,
+                           const std::string & path,
+                           const uint8_t * blob, size_t blob_size,
+                           int index, double size,
+                           float dpi, float dpi_height,
+                           GlyphPackPtr pack,
+                           SharedGlyphStorePtr store) {
+    font_desc_s fd;
+
+    fd.file_name = path;
+    fd.size = size;
+    fd.bold = false;
+    fd.underline = false;
+    fd.force_bold = false;
+    fd.index = index;
+    fd.blob = blob;
+    fd.blob_size = blob_size;
+
+    //no fallbacks until AddFallbackFont
+    auto f = std::make_shared<FontImpl>(memory_buffer, library, lock, desc, fd, font_desc_vector {}, dpi, dpi_height, pack, store);
+
+    if (!f->IsLoaded())
+        return FontPtr {};
+
+    return f;
+}
+
+bool AddFallbackFont(FontPtr font, FontPtr fallback) {
+    if (!font || !fallback || font == fallback)
+        return false;
+
+    //every font is created by a font manager
+    static_cast<FontImpl *>(font.get())->AddFallback(*static_cast<FontImpl *>(fallback.get()));
+    return true;
 }
 
 bool FontImpl::IsSameFont(const std::string & desc) {
@@ -246,6 +408,25 @@ bool FontImpl::IsSameFont(const std::string & desc) {
     return m_FontDesc == fdv[0];
 }
 
+void FontImpl::AddFallback(const FontImpl & fallback) {
+    std::lock_guard<std::recursive_mutex> guard(m_Lock);
+
+    //the face is loaded again by this font on first use
+    font_desc_s fd;
+    const font_desc_s & from = fallback.m_FontDesc;
+
+    fd.file_name = from.file_name;
+    fd.size = from.size;
+    fd.bold = from.bold;
+    fd.underline = from.underline;
+    fd.force_bold = from.force_bold;
+    fd.index = from.index;
+    fd.blob = from.blob;
+    fd.blob_size = from.blob_size;
+
+    m_FontDescs.push_back(fd);
+}
+
 void FontImpl::InitFont() {
     if (m_FontFaceInitialized)
         return;
@@ -262,49 +443,145 @@ void FontImpl::FreeFont() {
 }
 
 GlyphPtr FontImpl::LoadGlyph(uint32_t codepoint) {
-    auto it = m_Glyphs.find(codepoint);
+    std::lock_guard<std::recursive_mutex> guard(m_Lock);
+
+    auto id = LoadGlyphId(codepoint);
 
-    if (it != m_Glyphs.end())
-        return it->second;
+    if (id == INVALID_GLYPH_ID)
+        return GlyphPtr {};
 
-    FT_Face face = m_FontDesc.internal_font.m_Face;
+    return m_Glyphs[id];
+}
 
-    FT_UInt index = FT_Get_Char_Index(face, (FT_Long)codepoint);
+//fall back to the other matched fonts when the font has no such char
+bool FontImpl::FindGlyphIndex(uint32_t codepoint, font_desc_s *& font_desc, FT_UInt & index) {
+    font_desc = &m_FontDesc;
+    index = FT_Get_Char_Index(font_desc->internal_font.m_Face, (FT_Long)codepoint);
 
     if (!index) {
-        for(auto & font_desc : m_FontDescs) {
-            font_desc.LoadFont(m_Library, m_Dpi, m_DpiHeight);
+        for(auto & fallback : m_FontDescs) {
+            fallback.LoadFont(m_Library, m_Dpi, m_DpiHeight);
 
-            face = font_desc.internal_font.m_Face;
+            font_desc = &fallback;
 
-            if (!face)
+            if (!fallback.internal_font.m_Face)
                 continue;
 
-            index = FT_Get_Char_Index(face, (FT_Long)codepoint);
+            index = FT_Get_Char_Index(fallback.internal_font.m_Face, (FT_Long)codepoint);
 
             if (index) {
                 break;
             }
         }
 
-        if (!index)
-            std::cout << "no char index found for:" << codepoint << std::endl;
+        //the missing glyph of the font itself, not of its last fallback
+        if (!index) {
+            font_desc = &m_FontDesc;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FontImpl::HasGlyph(uint32_t codepoint) {
+    uint32_t index_in_pack = 0;
+
+    if (FindPacked(codepoint, index_in_pack))
+        return true;
+
+    std::lock_guard<std::recursive_mutex> guard(m_Lock);
+
+    font_desc_s * font_desc = nullptr;
+    FT_UInt index = 0;
+
+    return FindGlyphIndex(codepoint, font_desc, index);
+}
+
+uint32_t FontImpl::LoadGlyphId(uint32_t codepoint) {
+    auto id = m_GlyphTable.Find(codepoint);
+
+    if (id != INVALID_GLYPH_ID)
+        return id;
+
+    if (codepoint > glyph_table_s::MAX_CODEPOINT)
+        return INVALID_GLYPH_ID;
+
+    std::lock_guard<std::recursive_mutex> guard(m_Lock);
+
+    //another thread may have loaded it while we waited
+    id = m_GlyphTable.Find(codepoint);
+
+    if (id != INVALID_GLYPH_ID)
+        return id;
+
+    uint32_t index_in_pack = 0;
+
+    if (FindPacked(codepoint, index_in_pack)) {
+        const float * advance = m_PackFont->advances + index_in_pack * 2;
+        uint32_t offset = m_PackFont->geometry[index_in_pack * 2];
+        uint32_t size = m_PackFont->geometry[index_in_pack * 2 + 1];
+
+        //the mapping is read only, glyph geometry is never written
+        uint8_t * addr = size ? const_cast<uint8_t *>(m_PackFont->blobs + offset) : nullptr;
+        auto g = CreatePackedGlyph(codepoint, advance[0], advance[1], addr, size);
+
+        id = m_GlyphTable.Add(codepoint, advance[0], advance[1], addr, size);
+        m_Glyphs.push_back(g);
+
+        return id;
+    }
+
+    font_desc_s * font_desc = nullptr;
+    FT_UInt index = 0;
+
+    if (!FindGlyphIndex(codepoint, font_desc, index))
+        std::cout << "no char index found for:" << codepoint << std::endl;
+
+    FT_Face face = font_desc->internal_font.m_Face;
+    bool shared = m_GlyphStore && font_desc->internal_font.m_Initialized;
+    shared_glyph_key_s key {};
+
+    if (shared) {
+        InitSharedKey(*font_desc);
+
+        key.file_hash = font_desc->internal_font.m_FileHash;
+        key.face_index = font_desc->index;
+        key.glyph_index = index;
+        key.compile_hash = font_desc->internal_font.m_CompileHash;
+
+        //another process compiled it already, use its copy in place
+        shared_glyph_s found;
+
+        if (m_GlyphStore->Find(key, found)) {
+            auto g = CreatePackedGlyph(codepoint, found.advance_x, found.advance_y, found.addr, found.size);
+
+            id = m_GlyphTable.Add(codepoint, found.advance_x, found.advance_y, found.addr, found.size);
+            m_Glyphs.push_back(g);
+
+            return id;
+        }
     }
 
-    FT_Error error = FT_Load_Glyph(face,
-                                   index,
-                                   /*FT_LOAD_NO_SCALE |*/ FT_LOAD_NO_BITMAP | FT_LOAD_FORCE_AUTOHINT | FT_LOAD_TARGET_LCD);
+    FT_Error error = FT_Load_Glyph(face, index, GLYPH_LOAD_FLAGS);
     if(error) {
         err_msg(error, __LINE__);
-        return GlyphPtr {};
+        return INVALID_GLYPH_ID;
     }
 
-    auto g = CreateGlyph(m_MemoryBuffer, codepoint, face->units_per_EM, face->glyph);
+    auto g = shared
+            ? CreateSharedGlyph(m_MemoryBuffer, m_GlyphStore, key, codepoint, face->units_per_EM, face->glyph)
+            : CreateGlyph(m_MemoryBuffer, codepoint, face->units_per_EM, face->glyph);
+
+    if (!g)
+        return INVALID_GLYPH_ID;
 
-    if (g)
-        m_Glyphs.emplace(codepoint, g);
+    id = m_GlyphTable.Add(codepoint,
+                          g->GetAdvanceX(), g->GetAdvanceY(),
+                          g->GetAddr(), g->GetSize());
+    m_Glyphs.push_back(g);
 
-    return g;
+    return id;
 }
 
 bool FontImpl::LoadGlyphs(std::vector<uint32_t> codepoints,
@@ -323,6 +600,118 @@ bool FontImpl::LoadGlyphs(std::vector<uint32_t> codepoints,
     return all_loaded;
 }
 
+float FontImpl::GetAdvance(uint32_t codepoint) {
+    auto id = m_GlyphTable.Find(codepoint);
+
+    if (id != INVALID_GLYPH_ID)
+        return m_GlyphTable.AdvanceX(id);
+
+    if (codepoint > glyph_table_s::MAX_CODEPOINT)
+        return 0;
+
+    float advance = m_Advances.Find(codepoint);
+
+    if (!std::isnan(advance))
+        return advance;
+
+    std::lock_guard<std::recursive_mutex> guard(m_Lock);
+
+    advance = m_Advances.Find(codepoint);
+
+    if (std::isnan(advance)) {
+        advance = LoadAdvance(codepoint);
+        m_Advances.Add(codepoint, advance);
+    }
+
+    return advance;
+}
+
+bool FontImpl::FindPacked(uint32_t codepoint, uint32_t & index) const {
+    if (!m_PackFont)
+        return false;
+
+    const uint32_t * begin = m_PackFont->codepoints;
+    const uint32_t * end = begin + m_PackFont->count;
+    const uint32_t * it = std::lower_bound(begin, end, codepoint);
+
+    if (it == end || *it != codepoint)
+        return false;
+
+    index = it - begin;
+    return true;
+}
+
+void FontImpl::InitSharedKey(font_desc_s & font_desc) {
+    internal_font_s & font = font_desc.internal_font;
+
+    if (font.m_SharedKeyInited)
+        return;
+
+    if (font_desc.blob) {
+        font.m_FileHash = hash_bytes(font_desc.blob, font_desc.blob_size);
+    } else {
+        //a font file replaced in place must not hit glyphs of the old one
+        struct stat st;
+        uint64_t file_stamp[2] = {0, 0};
+
+        if (!stat(font_desc.file_name.c_str(), &st)) {
+            file_stamp[0] = st.st_size;
+            file_stamp[1] = st.st_mtime;
+        }
+
+        font.m_FileHash = hash_bytes(font_desc.file_name.data(), font_desc.file_name.size());
+        font.m_FileHash = hash_bytes(file_stamp, sizeof(file_stamp), font.m_FileHash);
+    }
+
+    int64_t compile_settings[4] = {(int)(font_desc.size * HRES),
+                                   (int64_t)floor(m_Dpi), (int64_t)floor(m_DpiHeight),
+                                   GLYPH_LOAD_FLAGS};
+
+    font.m_CompileHash = hash_bytes(compile_settings, sizeof(compile_settings));
+    font.m_SharedKeyInited = true;
+}
+
+float FontImpl::LoadAdvance(uint32_t codepoint) {
+    uint32_t index_in_pack = 0;
+
+    if (FindPacked(codepoint, index_in_pack))
+        return m_PackFont->advances[index_in_pack * 2];
+
+    font_desc_s * font_desc = nullptr;
+    FT_UInt index = 0;
+
+    if (!FindGlyphIndex(codepoint, font_desc, index))
+        std::cout << "no char index found for:" << codepoint << std::endl;
+
+    FT_Fixed advance = 0;
+    FT_Error error = FT_Get_Advance(font_desc->internal_font.m_Face, index, GLYPH_LOAD_FLAGS | FT_LOAD_ADVANCE_ONLY, &advance);
+
+    if (error) {
+        err_msg(error, __LINE__);
+        return 0;
+    }
+
+    //16.16 fixed point, same value as the 26.6 advance of a loaded glyph
+    return (float)advance / 65536.0;
+}
+
+double FontImpl::MeasureText(const wchar_t * text, size_t length) {
+    double width = 0;
+    double line_width = 0;
+
+    for(size_t i = 0; i < length; i++) {
+        if (text[i] == L'\n') {
+            width = std::max(width, line_width);
+            line_width = 0;
+            continue;
+        }
+
+        line_width += GetAdvance(text[i]);
+    }
+
+    return std::max(width, line_width);
+}
+
 void internal_font_s::Init(FT_Library & library, const font_desc_s & fontDesc, float dpi, float dpi_height) {
     if (m_Initialized) return;
 
@@ -331,7 +720,10 @@ void internal_font_s::Init(FT_Library & library, const font_desc_s & fontDesc, f
     m_Face = nullptr;
 
     /* Load face */
-    error = FT_New_Face(library, fontDesc.file_name.c_str(), fontDesc.index, &m_Face);
+    if (fontDesc.blob)
+        error = FT_New_Memory_Face(library, fontDesc.blob, fontDesc.blob_size, fontDesc.index, &m_Face);
+    else
+        error = FT_New_Face(library, fontDesc.file_name.c_str(), fontDesc.index, &m_Face);
 
     if(error) {
         std::cout << "font load failed:" << fontDesc.file_name << std::endl;
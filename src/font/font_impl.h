@@ -1,10 +1,20 @@
 #pragma once
 
 #include "font.h"
+#include "glyph_pack.h"
+#include "shared_glyph_store.h"
 #include <string>
+#include <mutex>
 
 namespace ftdgl {
 namespace impl {
-FontPtr CreateFontFromDesc(util::MemoryBufferPtr mem_buf, FT_Library & library, const std::string & desc, float dpi, float dpi_height);
+//lock guards the library, the memory buffer and glyph loading of all
+//fonts of a manager, glyphs found in pack are not compiled, glyphs found
+//in store are not compiled again and compiled ones are added to it
+FontPtr CreateFontFromDesc(util::MemoryBufferPtr mem_buf, FT_Library & library, std::recursive_mutex & lock, const std::string & desc, float dpi, float dpi_height, GlyphPackPtr pack, SharedGlyphStorePtr store);
+//face index of the font file at path, or of blob when set, empty when the
+//face can not be loaded
+FontPtr CreateFontFromFile(util::MemoryBufferPtr mem_buf, FT_Library & library, std::recursive_mutex & lock, const std::string & desc, const std::string & path, const uint8_t * blob, size_t blob_size, int index, double size, float dpi, float dpi_height, GlyphPackPtr pack, SharedGlyphStorePtr store);
+bool AddFallbackFont(FontPtr font, FontPtr fallback);
 } //namespace impl
 } //namespace ftdgl
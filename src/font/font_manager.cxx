@@ -7,9 +7,16 @@
 #include "font_manager.h"
 #include "memory_buffer.h"
 #include "font_impl.h"
+#include "glyph_pack.h"
+#include "shared_glyph_store.h"
 #include "err_msg.h"
 
 #include <forward_list>
+#include <vector>
+#include <mutex>
+#include <sstream>
+#include <iostream>
+#include <cstring>
 
 namespace ftdgl {
 namespace impl {
@@ -20,13 +27,16 @@ constexpr size_t DEFAULT_MEM_BUF_SIZE = 64 * 1024 * 1024;
 
 class FontManagerImpl : public FontManager {
 public:
-    FontManagerImpl(size_t mem_buf_size,float dpi, float dpi_height)
+    FontManagerImpl(size_t mem_buf_size,float dpi, float dpi_height, SharedGlyphStorePtr store)
         : m_Fonts {}
         , m_LibInited {false}
         , m_Library {}
+        , m_Lock {}
         , m_MemoryBuffer {util::CreateMemoryBuffer(mem_buf_size)}
         , m_Dpi {dpi}
         , m_DpiHeight {dpi_height}
+        , m_Packs {}
+        , m_GlyphStore {store}
     {
         InitFreeTypeLib();
     }
@@ -39,6 +49,12 @@ public:
 
 public:
     virtual FontPtr CreateFontFromDesc(const std::string &desc);
+    virtual FontPtr CreateFontFromFile(const std::string &path, int index,
+                                       double size);
+    virtual FontPtr CreateFontFromMemory(const uint8_t *blob, size_t blob_size,
+                                         int index, double size);
+    virtual bool AddFallbackFont(FontPtr font, FontPtr fallback);
+    virtual bool LoadGlyphPack(const std::string &path);
 
 private:
     void InitFreeTypeLib() {
@@ -61,35 +77,210 @@ private:
         FT_Done_FreeType( m_Library );
     }
 
+    FontPtr FindFont(const std::string &desc) const;
+    GlyphPackPtr FindPack(const std::string &desc) const;
+    FontPtr CreateFontFromSource(const std::string &desc,
+                                 const std::string &path,
+                                 const uint8_t *blob, size_t blob_size,
+                                 int index, double size);
+
     FontPtrList m_Fonts;
 
     bool m_LibInited;
     FT_Library m_Library;
+    std::recursive_mutex m_Lock;
 
     util::MemoryBufferPtr m_MemoryBuffer;
     float m_Dpi;
     float m_DpiHeight;
+
+    std::vector<GlyphPackPtr> m_Packs;
+    SharedGlyphStorePtr m_GlyphStore;
 };
 
+FontPtr FontManagerImpl::FindFont(const std::string &desc) const {
+    for(const auto & f : m_Fonts) {
+        if (f->GetDesc() == desc) {
+            return f;
+        }
+    }
+
+    return FontPtr {};
+}
+
+//the first pack holding the font serves its glyphs
+GlyphPackPtr FontManagerImpl::FindPack(const std::string &desc) const {
+    for(const auto & p : m_Packs) {
+        if (p->FindFont(desc, m_Dpi, m_DpiHeight)) {
+            return p;
+        }
+    }
+
+    return GlyphPackPtr {};
+}
+
+static
+const
+char FILE_DESC_PREFIX[] = "file=";
+
+static
+const
+char MEMORY_DESC_PREFIX[] = "memory=";
+
+static
+bool has_prefix(const std::string &desc, const char *prefix) {
+    return desc.compare(0, strlen(prefix), prefix) == 0;
+}
+
+//file=<path>:index=<index>:size=<size> as CreateFontFromFile writes it,
+//fields are taken from the end since the path may hold ':'
+static
+bool parse_file_desc(const std::string &desc, std::string &path, int &index, double &size) {
+    size_t size_pos = desc.rfind(":size=");
+    size_t index_pos = size_pos == std::string::npos ? size_pos : desc.rfind(":index=", size_pos);
+
+    if (index_pos == std::string::npos || index_pos <= strlen(FILE_DESC_PREFIX))
+        return false;
+
+    std::istringstream index_field(desc.substr(index_pos + 7, size_pos - index_pos - 7));
+    std::istringstream size_field(desc.substr(size_pos + 6));
+
+    if (!(index_field >> index) || !index_field.eof()
+        || !(size_field >> size) || !size_field.eof())
+        return false;
+
+    path = desc.substr(strlen(FILE_DESC_PREFIX), index_pos - strlen(FILE_DESC_PREFIX));
+    return true;
+}
+
 FontPtr FontManagerImpl::CreateFontFromDesc(const std::string &desc) {
+    std::lock_guard<std::recursive_mutex> guard(m_Lock);
+
+    //same description, or one a file or memory font was given, needs no
+    //fontconfig match
+    auto found = FindFont(desc);
+
+    if (found)
+        return found;
+
+    //descriptions of file and memory fonts never go to fontconfig, it
+    //would match some other face for them
+    if (has_prefix(desc, FILE_DESC_PREFIX)) {
+        std::string path;
+        int index = 0;
+        double size = 0;
+
+        if (!parse_file_desc(desc, path, index, size)) {
+            std::cerr << "bad font file description " << desc << std::endl;
+            return FontPtr {};
+        }
+
+        return CreateFontFromFile(path, index, size);
+    }
+
+    if (has_prefix(desc, MEMORY_DESC_PREFIX)) {
+        std::cerr << "memory font " << desc << " has to be created with CreateFontFromMemory first" << std::endl;
+        return FontPtr {};
+    }
+
+#ifndef USE_FONTCONFIG
+    std::cerr << "built without fontconfig, could not create font " << desc << std::endl;
+    return FontPtr {};
+#else
     for(const auto & f : m_Fonts) {
         if (f->IsSameFont(desc)) {
             return f;
         }
     }
 
-    auto f = impl::CreateFontFromDesc(m_MemoryBuffer, m_Library, desc, m_Dpi, m_DpiHeight);
+    auto f = impl::CreateFontFromDesc(m_MemoryBuffer, m_Library, m_Lock, desc, m_Dpi, m_DpiHeight, FindPack(desc), m_GlyphStore);
 
     if (f)
         m_Fonts.push_front(f);
 
     return f;
+#endif
+}
+
+FontPtr FontManagerImpl::CreateFontFromFile(const std::string &path, int index,
+                                            double size) {
+    std::ostringstream desc;
+
+    desc << "file=" << path << ":index=" << index << ":size=" << size;
+
+    return CreateFontFromSource(desc.str(), path, nullptr, 0, index, size);
+}
+
+FontPtr FontManagerImpl::CreateFontFromMemory(const uint8_t *blob, size_t blob_size,
+                                              int index, double size) {
+    //the blob address only names the font within this process
+    std::ostringstream desc;
+
+    desc << "memory=" << static_cast<const void *>(blob) << ":length=" << blob_size
+         << ":index=" << index << ":size=" << size;
+
+    return CreateFontFromSource(desc.str(), "", blob, blob_size, index, size);
+}
+
+FontPtr FontManagerImpl::CreateFontFromSource(const std::string &desc,
+                                              const std::string &path,
+                                              const uint8_t *blob, size_t blob_size,
+                                              int index, double size) {
+    std::lock_guard<std::recursive_mutex> guard(m_Lock);
+
+    auto found = FindFont(desc);
+
+    if (found)
+        return found;
+
+    auto f = impl::CreateFontFromFile(m_MemoryBuffer, m_Library, m_Lock, desc,
+                                      path, blob, blob_size, index, size,
+                                      m_Dpi, m_DpiHeight, FindPack(desc), m_GlyphStore);
+
+    if (f)
+        m_Fonts.push_front(f);
+    else
+        std::cerr << "could not create font " << desc << std::endl;
+
+    return f;
+}
+
+bool FontManagerImpl::AddFallbackFont(FontPtr font, FontPtr fallback) {
+    std::lock_guard<std::recursive_mutex> guard(m_Lock);
+
+    return impl::AddFallbackFont(font, fallback);
+}
+
+bool FontManagerImpl::LoadGlyphPack(const std::string &path) {
+    auto pack = ftdgl::LoadGlyphPack(path);
+
+    if (!pack)
+        return false;
+
+    std::lock_guard<std::recursive_mutex> guard(m_Lock);
+
+    m_Packs.push_back(pack);
+    return true;
 }
 } // namespace impl
 
 FontManagerPtr CreateFontManager(float dpi, float dpi_height) {
     return std::make_shared<impl::FontManagerImpl>(impl::DEFAULT_MEM_BUF_SIZE,
                                                    dpi,
-                                                   dpi_height);
+                                                   dpi_height,
+                                                   impl::SharedGlyphStorePtr {});
+}
+
+FontManagerPtr CreateFontManager(float dpi, float dpi_height,
+                                 const std::string &shared_glyph_store,
+                                 size_t store_size) {
+    return std::make_shared<impl::FontManagerImpl>(impl::DEFAULT_MEM_BUF_SIZE,
+                                                   dpi,
+                                                   dpi_height,
+                                                   impl::CreateSharedGlyphStore(shared_glyph_store, store_size));
+}
+
+bool RemoveSharedGlyphStore(const std::string &shared_glyph_store) {
+    return impl::RemoveSharedGlyphStore(shared_glyph_store);
 }
 } // namespace ftdgl
@@ -12,10 +12,36 @@ public:
   virtual ~FontManager() = default;
 
 public:
+  // match desc with fontconfig, fails when built without it, a desc
+  // CreateFontFromFile gave opens the file instead and one
+  // CreateFontFromMemory gave fails unless that font exists already
   virtual FontPtr CreateFontFromDesc(const std::string &desc) = 0;
+  // face index of the font file at path at size points, without fontconfig
+  virtual FontPtr CreateFontFromFile(const std::string &path, int index,
+                                     double size) = 0;
+  // same as CreateFontFromFile for a font file in memory, blob is not
+  // copied and must outlive the font
+  virtual FontPtr CreateFontFromMemory(const uint8_t *blob, size_t blob_size,
+                                       int index, double size) = 0;
+  // glyphs font lacks are loaded from fallback, fallbacks are tried in the
+  // order added and after the ones fontconfig matched, glyphs loaded
+  // before are kept
+  virtual bool AddFallbackFont(FontPtr font, FontPtr fallback) = 0;
+  // map a pack written by ftdgl-pack, fonts created afterwards from a
+  // description and dpi in the pack take their glyphs from it and only
+  // compile glyphs the pack lacks
+  virtual bool LoadGlyphPack(const std::string &path) = 0;
 };
 
 using FontManagerPtr = std::shared_ptr<FontManager>;
 
 FontManagerPtr CreateFontManager(float dpi, float dpi_height);
+// glyphs compiled by any process using the same shared glyph store name
+// are used in place by all of them, the store is created with store_size
+// bytes by the first process and stays until RemoveSharedGlyphStore, glyphs
+// are compiled privately when it can not be opened or is full
+FontManagerPtr CreateFontManager(float dpi, float dpi_height,
+                                 const std::string &shared_glyph_store,
+                                 size_t store_size);
+bool RemoveSharedGlyphStore(const std::string &shared_glyph_store);
 }; // namespace ftdgl
@@ -6,6 +6,7 @@
 
 #include <cassert>
 #include <iostream>
+#include <algorithm>
 
 #include "opengl.h"
 
@@ -74,6 +75,14 @@ size_t compile_glyph(uint8_t * addr, int unitPerEM, FT_Outline & outline) {
     return context.size;
 }
 
+size_t compile_glyph_bound(const FT_Outline & outline) {
+    //a point starts at most one segment, a segment closes at most one
+    //solid triangle and adds at most one curve per cubic split
+    size_t triangles = static_cast<size_t>(std::max<int>(outline.n_points, 0)) * (CU2QU_MAX_N + 1);
+
+    return triangles * 3 * sizeof(GLfloat) * 4;
+}
+
 int MoveToFunction(const FT_Vector *to,
                    void *user) {
     compile_context_s * context = reinterpret_cast<compile_context_s*>(user);
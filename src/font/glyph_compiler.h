@@ -4,6 +4,8 @@ namespace ftdgl {
 namespace impl {
 
 size_t compile_glyph(uint8_t * addr, int unitPerEM, FT_Outline & outline);
+//bytes compile_glyph writes at most for outline
+size_t compile_glyph_bound(const FT_Outline & outline);
 
 } //namespace impl
 } //namespace ftdgl
@@ -8,9 +8,11 @@
 #include "glyph_impl.h"
 #include "glyph_compiler.h"
 
-#include <fontconfig/fontconfig.h>
 #include <iostream>
 #include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include <cstring>
 
 namespace ftdgl {
 namespace impl {
@@ -28,6 +30,16 @@ public:
         InitGlyph(slot);
     }
 
+    GlyphImpl(uint32_t codepoint, float advance_x, float advance_y, uint8_t * addr, size_t size)
+        : m_UnitPerEM{0}
+        , m_Codepoint{codepoint}
+        , m_AdvanceX{advance_x}
+        , m_AdvanceY{advance_y}
+        , m_Addr{addr}
+        , m_Size{size}
+    {
+    }
+
     virtual ~GlyphImpl() {
     }
 
@@ -84,5 +96,41 @@ GlyphPtr CreateGlyph(util::MemoryBufferPtr mem_buf, uint32_t codepoint, int unit
     return std::make_shared<GlyphImpl>(codepoint, unitPerEM, slot, addr, size);
 }
 
+GlyphPtr CreatePackedGlyph(uint32_t codepoint, float advance_x, float advance_y, uint8_t * addr, size_t size) {
+    return std::make_shared<GlyphImpl>(codepoint, advance_x, advance_y, addr, size);
+}
+
+GlyphPtr CreateSharedGlyph(util::MemoryBufferPtr mem_buf, SharedGlyphStorePtr store, const shared_glyph_key_s & key,
+                           uint32_t codepoint, int unitPerEM, FT_GlyphSlot & slot) {
+    //compiled size is only known afterwards, compile into scratch sized
+    //for the worst case then copy exactly that many bytes out
+    static thread_local std::vector<uint8_t> scratch;
+
+    size_t size = 0;
+
+    if (OutlineExist(slot)) {
+        scratch.resize(std::max(scratch.size(), compile_glyph_bound(slot->outline)));
+        size = compile_glyph(scratch.data(), unitPerEM, slot->outline);
+    }
+
+    float advance_x = (float)slot->advance.x / 64.0;
+    float advance_y = (float)slot->advance.y;
+
+    shared_glyph_s shared;
+
+    if (store->Add(key, advance_x, advance_y, scratch.data(), size, shared))
+        return CreatePackedGlyph(codepoint, shared.advance_x, shared.advance_y, shared.addr, shared.size);
+
+    uint8_t * addr = nullptr;
+
+    if (size) {
+        addr = mem_buf->Begin();
+        memcpy(addr, scratch.data(), size);
+        mem_buf->End(size);
+    }
+
+    return std::make_shared<GlyphImpl>(codepoint, unitPerEM, slot, addr, size);
+}
+
 } //namespace impl
 } //namespace ftdgl
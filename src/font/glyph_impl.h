@@ -1,9 +1,15 @@
 #pragma once
 
 #include "glyph.h"
+#include "shared_glyph_store.h"
 
 namespace ftdgl {
 namespace impl {
 GlyphPtr CreateGlyph(util::MemoryBufferPtr mem_buf, uint32_t codepoint, int unitPerEM, FT_GlyphSlot & slot);
+//a glyph compiled ahead of time, addr is not owned
+GlyphPtr CreatePackedGlyph(uint32_t codepoint, float advance_x, float advance_y, uint8_t * addr, size_t size);
+//compile into the shared store under key, into mem_buf when it is full
+GlyphPtr CreateSharedGlyph(util::MemoryBufferPtr mem_buf, SharedGlyphStorePtr store, const shared_glyph_key_s & key,
+                           uint32_t codepoint, int unitPerEM, FT_GlyphSlot & slot);
 } //namespace impl
 } //namespace ftdgl
@@ -0,0 +1,289 @@
+#include "glyph_pack.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+namespace ftdgl {
+namespace impl {
+
+static
+const
+char GLYPH_PACK_MAGIC[4] = {'F', 'D', 'G', 'P'};
+
+constexpr uint32_t GLYPH_PACK_VERSION = 1;
+
+//sections follow the header at 4 byte aligned offsets from the start of
+//the file, integers and floats in the byte order of the writer
+typedef struct __pack_file_header_s {
+    char magic[4];
+    uint32_t version;
+    uint32_t file_size;
+    float dpi;
+    float dpi_height;
+    uint32_t font_count;
+    uint32_t font_offset;
+    uint32_t string_offset;
+    uint32_t blob_offset;
+    uint32_t blob_size;
+} pack_file_header_s;
+
+//offsets of the per glyph arrays of a font, codepoints ascending
+typedef struct __pack_file_font_s {
+    uint32_t desc_offset;
+    uint32_t desc_length;
+    uint32_t glyph_count;
+    uint32_t codepoint_offset;
+    uint32_t advance_offset;
+    uint32_t geometry_offset;
+} pack_file_font_s;
+
+typedef struct __pack_font_s {
+    std::string desc;
+    glyph_pack_font_s glyphs;
+} pack_font_s;
+
+class GlyphPackImpl : public GlyphPack {
+public:
+    GlyphPackImpl()
+        : m_File {}
+        , m_Region {}
+        , m_Dpi {0}
+        , m_DpiHeight {0}
+        , m_Fonts {} {
+    }
+
+    virtual ~GlyphPackImpl() = default;
+
+public:
+    virtual const glyph_pack_font_s * FindFont(const std::string & desc,
+                                               float dpi, float dpi_height) const;
+
+    bool Load(const std::string & path);
+
+private:
+    boost::interprocess::file_mapping m_File;
+    boost::interprocess::mapped_region m_Region;
+
+    float m_Dpi;
+    float m_DpiHeight;
+    std::vector<pack_font_s> m_Fonts;
+};
+
+//count items of size bytes at offset fit in size bytes
+static
+bool section_fits(uint32_t offset, uint32_t count, size_t item_size, size_t size) {
+    return offset % 4 == 0
+            && offset <= size
+            && count <= (size - offset) / item_size;
+}
+
+bool GlyphPackImpl::Load(const std::string & path) {
+    try {
+        m_File = boost::interprocess::file_mapping(path.c_str(), boost::interprocess::read_only);
+        m_Region = boost::interprocess::mapped_region(m_File, boost::interprocess::read_only);
+    } catch (const boost::interprocess::interprocess_exception & e) {
+        std::cerr << "could not map glyph pack " << path << ":" << e.what() << std::endl;
+        return false;
+    }
+
+    const uint8_t * data = static_cast<const uint8_t *>(m_Region.get_address());
+    size_t size = m_Region.get_size();
+
+    pack_file_header_s header;
+
+    if (size < sizeof(header)) {
+        std::cerr << "glyph pack " << path << " is too short" << std::endl;
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, GLYPH_PACK_MAGIC, sizeof(header.magic))
+        || header.version != GLYPH_PACK_VERSION
+        || header.file_size != size
+        || !section_fits(header.font_offset, header.font_count, sizeof(pack_file_font_s), size)
+        || header.string_offset > size
+        || !section_fits(header.blob_offset, header.blob_size, 1, size)) {
+        std::cerr << "glyph pack " << path << " is not valid" << std::endl;
+        return false;
+    }
+
+    m_Dpi = header.dpi;
+    m_DpiHeight = header.dpi_height;
+
+    const pack_file_font_s * fonts = reinterpret_cast<const pack_file_font_s *>(data + header.font_offset);
+    const char * strings = reinterpret_cast<const char *>(data + header.string_offset);
+    size_t string_size = size - header.string_offset;
+    const uint8_t * blobs = data + header.blob_offset;
+
+    for(uint32_t f = 0; f < header.font_count; f++) {
+        const auto & font = fonts[f];
+
+        if (font.desc_offset > string_size
+            || font.desc_length > string_size - font.desc_offset
+            || !section_fits(font.codepoint_offset, font.glyph_count, sizeof(uint32_t), size)
+            || !section_fits(font.advance_offset, font.glyph_count, sizeof(float) * 2, size)
+            || !section_fits(font.geometry_offset, font.glyph_count, sizeof(uint32_t) * 2, size)) {
+            std::cerr << "glyph pack " << path << " is not valid" << std::endl;
+            return false;
+        }
+
+        glyph_pack_font_s glyphs {font.glyph_count,
+                                  reinterpret_cast<const uint32_t *>(data + font.codepoint_offset),
+                                  reinterpret_cast<const float *>(data + font.advance_offset),
+                                  reinterpret_cast<const uint32_t *>(data + font.geometry_offset),
+                                  blobs};
+
+        //lookups binary search the codepoints, geometry is drawn as is
+        for(uint32_t g = 0; g < glyphs.count; g++) {
+            uint32_t offset = glyphs.geometry[g * 2];
+            uint32_t length = glyphs.geometry[g * 2 + 1];
+
+            if ((g && glyphs.codepoints[g - 1] >= glyphs.codepoints[g])
+                || !section_fits(offset, length, 1, header.blob_size)) {
+                std::cerr << "glyph pack " << path << " is not valid" << std::endl;
+                return false;
+            }
+        }
+
+        m_Fonts.push_back({std::string(strings + font.desc_offset, font.desc_length), glyphs});
+    }
+
+    return true;
+}
+
+const glyph_pack_font_s * GlyphPackImpl::FindFont(const std::string & desc,
+                                                  float dpi, float dpi_height) const {
+    //glyph geometry is compiled at the dpi of the pack
+    if (dpi != m_Dpi || dpi_height != m_DpiHeight)
+        return nullptr;
+
+    for(const auto & font : m_Fonts) {
+        if (font.desc == desc)
+            return &font.glyphs;
+    }
+
+    return nullptr;
+}
+
+static
+uint32_t align4(size_t v) {
+    return static_cast<uint32_t>((v + 3) / 4 * 4);
+}
+
+} //namespace impl
+
+GlyphPackPtr LoadGlyphPack(const std::string & path) {
+    auto pack = std::make_shared<impl::GlyphPackImpl>();
+
+    if (!pack->Load(path))
+        return GlyphPackPtr {};
+
+    return pack;
+}
+
+bool WriteGlyphPack(const std::vector<FontPtr> & fonts,
+                    float dpi, float dpi_height,
+                    const std::string & path) {
+    impl::pack_file_header_s header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, impl::GLYPH_PACK_MAGIC, sizeof(header.magic));
+
+    header.version = impl::GLYPH_PACK_VERSION;
+    header.dpi = dpi;
+    header.dpi_height = dpi_height;
+    header.font_count = fonts.size();
+    header.font_offset = impl::align4(sizeof(header));
+
+    std::vector<impl::pack_file_font_s> font_entries(fonts.size());
+    std::vector<uint32_t> glyph_arrays;
+    std::vector<uint8_t> blobs;
+    std::string strings;
+
+    //glyph arrays start right after the font entries
+    uint32_t offset = header.font_offset + fonts.size() * sizeof(impl::pack_file_font_s);
+
+    for(size_t f = 0; f < fonts.size(); f++) {
+        const auto & glyphs = fonts[f]->GetGlyphTable();
+        uint32_t count = glyphs.Count();
+
+        std::vector<uint32_t> ids(count);
+
+        for(uint32_t id = 0; id < count; id++)
+            ids[id] = id;
+
+        std::sort(ids.begin(), ids.end(), [&glyphs](uint32_t a, uint32_t b) {
+                return glyphs.Codepoint(a) < glyphs.Codepoint(b);
+            });
+
+        auto & entry = font_entries[f];
+
+        entry.desc_offset = strings.size();
+        entry.desc_length = fonts[f]->GetDesc().size();
+        entry.glyph_count = count;
+        entry.codepoint_offset = offset;
+        entry.advance_offset = entry.codepoint_offset + count * sizeof(uint32_t);
+        entry.geometry_offset = entry.advance_offset + count * sizeof(float) * 2;
+        offset = entry.geometry_offset + count * sizeof(uint32_t) * 2;
+
+        strings += fonts[f]->GetDesc();
+
+        for(auto id : ids)
+            glyph_arrays.push_back(glyphs.Codepoint(id));
+
+        for(auto id : ids) {
+            float advance[2] = {glyphs.AdvanceX(id), glyphs.AdvanceY(id)};
+            uint32_t bits[2];
+
+            memcpy(bits, advance, sizeof(bits));
+            glyph_arrays.insert(glyph_arrays.end(), bits, bits + 2);
+        }
+
+        for(auto id : ids) {
+            //vertices are floats, so every blob stays 4 byte aligned
+            glyph_arrays.push_back(blobs.size());
+            glyph_arrays.push_back(glyphs.Size(id));
+
+            if (glyphs.Addr(id))
+                blobs.insert(blobs.end(), glyphs.Addr(id), glyphs.Addr(id) + glyphs.Size(id));
+        }
+    }
+
+    header.string_offset = offset;
+    header.blob_offset = header.string_offset + impl::align4(strings.size());
+    header.blob_size = blobs.size();
+    header.file_size = header.blob_offset + blobs.size();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    if (!file) {
+        std::cerr << "could not create glyph pack " << path << std::endl;
+        return false;
+    }
+
+    static const char padding[4] = {0, 0, 0, 0};
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(padding, header.font_offset - sizeof(header));
+    file.write(reinterpret_cast<const char *>(font_entries.data()),
+               font_entries.size() * sizeof(impl::pack_file_font_s));
+    file.write(reinterpret_cast<const char *>(glyph_arrays.data()),
+               glyph_arrays.size() * sizeof(uint32_t));
+    file.write(strings.data(), strings.size());
+    file.write(padding, header.blob_offset - header.string_offset - strings.size());
+    file.write(reinterpret_cast<const char *>(blobs.data()), blobs.size());
+
+    if (!file) {
+        std::cerr << "could not write glyph pack " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+} //namespace ftdgl
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "font.h"
+
+namespace ftdgl {
+
+//compiled glyphs of one font of a pack, arrays are indexed alike and
+//sorted by codepoint
+typedef struct __glyph_pack_font_s {
+    uint32_t count;
+    const uint32_t * codepoints;
+    //advance x and y of each glyph
+    const float * advances;
+    //byte offset into blobs and byte size of the geometry of each glyph,
+    //size 0 for glyphs without outline
+    const uint32_t * geometry;
+    const uint8_t * blobs;
+} glyph_pack_font_s;
+
+//a glyph pack file mapped read only, glyph geometry is used in place
+class GlyphPack {
+public:
+    GlyphPack() = default;
+    virtual ~GlyphPack() = default;
+
+public:
+    //glyphs compiled for the font created from desc at dpi, nullptr when
+    //the pack has none, valid as long as the pack
+    virtual const glyph_pack_font_s * FindFont(const std::string & desc,
+                                               float dpi, float dpi_height) const = 0;
+};
+
+using GlyphPackPtr = std::shared_ptr<GlyphPack>;
+
+//empty when the file is not a valid pack of this version
+GlyphPackPtr LoadGlyphPack(const std::string & path);
+//write the glyphs loaded so far into fonts, all created at dpi, to path
+bool WriteGlyphPack(const std::vector<FontPtr> & fonts,
+                    float dpi, float dpi_height,
+                    const std::string & path);
+
+} //namespace ftdgl
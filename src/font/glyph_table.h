@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace ftdgl {
+
+constexpr uint32_t INVALID_GLYPH_ID = 0xFFFFFFFF;
+
+//glyph metadata of a font stored as arrays indexed by a dense glyph id,
+//codepoint to glyph id goes through a two level page table
+//
+//entries live in fixed blocks that never move, so Find and the getters
+//are safe from any thread while one thread at a time calls Add, an id
+//is published only after its entry is written
+struct glyph_table_s {
+    static constexpr uint32_t PAGE_BITS = 8;
+    static constexpr uint32_t PAGE_SIZE = 1 << PAGE_BITS;
+    static constexpr uint32_t MAX_CODEPOINT = 0x10FFFF;
+    static constexpr uint32_t PAGE_COUNT = (MAX_CODEPOINT >> PAGE_BITS) + 1;
+
+    static constexpr uint32_t BLOCK_BITS = 10;
+    static constexpr uint32_t BLOCK_SIZE = 1 << BLOCK_BITS;
+    static constexpr uint32_t MAX_GLYPHS = 1 << 21;
+    static constexpr uint32_t BLOCK_COUNT = MAX_GLYPHS >> BLOCK_BITS;
+
+    typedef struct __block_s {
+        uint32_t codepoint[BLOCK_SIZE];
+        float advance_x[BLOCK_SIZE];
+        float advance_y[BLOCK_SIZE];
+        uint8_t * addr[BLOCK_SIZE];
+        uint32_t size[BLOCK_SIZE];
+    } block_s;
+
+    using page_ptr = std::atomic<uint32_t> *;
+
+    std::vector<std::atomic<page_ptr>> pages;
+    std::vector<std::atomic<block_s *>> blocks;
+    std::atomic<uint32_t> count;
+
+    glyph_table_s()
+        : pages(PAGE_COUNT)
+        , blocks(BLOCK_COUNT)
+        , count {0} {
+        for(auto & p : pages)
+            p.store(nullptr, std::memory_order_relaxed);
+
+        for(auto & b : blocks)
+            b.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~glyph_table_s() {
+        for(auto & p : pages)
+            delete [] p.load(std::memory_order_relaxed);
+
+        for(auto & b : blocks)
+            delete b.load(std::memory_order_relaxed);
+    }
+
+    glyph_table_s(const glyph_table_s &) = delete;
+    glyph_table_s & operator = (const glyph_table_s &) = delete;
+
+    uint32_t Find(uint32_t cp) const {
+        if (cp > MAX_CODEPOINT)
+            return INVALID_GLYPH_ID;
+
+        page_ptr page = pages[cp >> PAGE_BITS].load(std::memory_order_acquire);
+
+        return page ? page[cp & (PAGE_SIZE - 1)].load(std::memory_order_acquire) : INVALID_GLYPH_ID;
+    }
+
+    uint32_t Add(uint32_t cp, float adv_x, float adv_y, uint8_t * glyph_addr, size_t glyph_size) {
+        uint32_t id = count.load(std::memory_order_relaxed);
+
+        if (cp > MAX_CODEPOINT || id >= MAX_GLYPHS)
+            return INVALID_GLYPH_ID;
+
+        page_ptr page = pages[cp >> PAGE_BITS].load(std::memory_order_relaxed);
+
+        if (!page) {
+            page = new std::atomic<uint32_t>[PAGE_SIZE];
+
+            for(uint32_t i = 0; i < PAGE_SIZE; i++)
+                page[i].store(INVALID_GLYPH_ID, std::memory_order_relaxed);
+
+            pages[cp >> PAGE_BITS].store(page, std::memory_order_release);
+        }
+
+        block_s * block = blocks[id >> BLOCK_BITS].load(std::memory_order_relaxed);
+
+        if (!block) {
+            block = new block_s;
+            blocks[id >> BLOCK_BITS].store(block, std::memory_order_release);
+        }
+
+        uint32_t i = id & (BLOCK_SIZE - 1);
+
+        block->codepoint[i] = cp;
+        block->advance_x[i] = adv_x;
+        block->advance_y[i] = adv_y;
+        block->addr[i] = glyph_addr;
+        block->size[i] = glyph_size;
+
+        count.store(id + 1, std::memory_order_release);
+        page[cp & (PAGE_SIZE - 1)].store(id, std::memory_order_release);
+        return id;
+    }
+
+    const block_s & Block(uint32_t id) const {
+        return *blocks[id >> BLOCK_BITS].load(std::memory_order_acquire);
+    }
+
+    uint32_t Count() const { return count.load(std::memory_order_acquire); }
+    uint32_t Codepoint(uint32_t id) const { return Block(id).codepoint[id & (BLOCK_SIZE - 1)]; }
+    float AdvanceX(uint32_t id) const { return Block(id).advance_x[id & (BLOCK_SIZE - 1)]; }
+    float AdvanceY(uint32_t id) const { return Block(id).advance_y[id & (BLOCK_SIZE - 1)]; }
+    uint8_t * Addr(uint32_t id) const { return Block(id).addr[id & (BLOCK_SIZE - 1)]; }
+    uint32_t Size(uint32_t id) const { return Block(id).size[id & (BLOCK_SIZE - 1)]; }
+    bool NeedDraw(uint32_t id) const { return Addr(id) != nullptr; }
+    //each vertex is 4 floats: x, y, s, t
+    uint32_t VertexCount(uint32_t id) const { return Size(id) / sizeof(float) / 4; }
+};
+
+} //namespace ftdgl
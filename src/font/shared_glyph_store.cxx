@@ -0,0 +1,380 @@
+#include "shared_glyph_store.h"
+
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstring>
+
+//atomics in the region are shared between processes, which only works
+//for lock free ones
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "shared glyph store needs lock free atomics");
+
+namespace ftdgl {
+namespace impl {
+
+static
+const
+char SHARED_GLYPH_STORE_MAGIC[4] = {'F', 'D', 'G', 'S'};
+
+constexpr uint32_t SHARED_GLYPH_STORE_VERSION = 1;
+
+//one index slot per this many bytes of the store
+constexpr size_t BYTES_PER_SLOT = 4096;
+constexpr size_t MIN_SLOT_COUNT = 256;
+//of the slot and blob areas, and of each blob
+constexpr uint64_t AREA_ALIGNMENT = 64;
+constexpr uint64_t BLOB_ALIGNMENT = 16;
+
+//how long an opener waits for the creator to lay out the store
+constexpr int OPEN_RETRY_COUNT = 1000;
+//how many times a lookup yields for a slot another process is writing
+constexpr int WRITING_RETRY_COUNT = 64;
+
+enum slot_state_e {
+    SLOT_EMPTY = 0,
+    SLOT_WRITING,
+    SLOT_READY,
+    //claimed when the blob area ran out, probes go past it
+    SLOT_ABANDONED,
+};
+
+typedef struct __store_header_s {
+    char magic[4];
+    uint32_t version;
+    //set last by the creator
+    std::atomic<uint32_t> ready;
+    uint32_t slot_count;
+    uint64_t slot_offset;
+    uint64_t blob_offset;
+    uint64_t blob_size;
+    //bump allocator of the blob area
+    std::atomic<uint64_t> blob_top;
+} store_header_s;
+
+//fields other than state are written by the process that claimed the
+//slot and read only after state is SLOT_READY
+typedef struct __store_slot_s {
+    std::atomic<uint32_t> state;
+    uint32_t face_index;
+    uint32_t glyph_index;
+    uint32_t size;
+    uint64_t file_hash;
+    uint64_t compile_hash;
+    uint64_t offset;
+    float advance_x;
+    float advance_y;
+} store_slot_s;
+
+class SharedGlyphStoreImpl : public SharedGlyphStore {
+public:
+    SharedGlyphStoreImpl()
+        : m_Memory {}
+        , m_Region {}
+        , m_Header {nullptr}
+        , m_Slots {nullptr}
+        , m_Blobs {nullptr} {
+    }
+
+    virtual ~SharedGlyphStoreImpl() = default;
+
+public:
+    virtual bool Find(const shared_glyph_key_s & key, shared_glyph_s & glyph);
+    virtual bool Add(const shared_glyph_key_s & key,
+                     float advance_x, float advance_y,
+                     const uint8_t * addr, size_t size,
+                     shared_glyph_s & glyph);
+
+    bool Open(const std::string & name, size_t size);
+
+private:
+    bool Create(const std::string & name, size_t size);
+    bool Attach(const std::string & name);
+    //false when the slot points outside the blob area
+    bool Fill(const store_slot_s & slot, shared_glyph_s & glyph) const;
+
+    boost::interprocess::shared_memory_object m_Memory;
+    boost::interprocess::mapped_region m_Region;
+
+    store_header_s * m_Header;
+    store_slot_s * m_Slots;
+    uint8_t * m_Blobs;
+};
+
+uint64_t hash_bytes(const void * data, size_t size, uint64_t seed) {
+    //FNV-1a
+    const uint8_t * bytes = static_cast<const uint8_t *>(data);
+    uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static
+uint64_t hash_key(const shared_glyph_key_s & key) {
+    uint64_t hash = hash_bytes(&key.file_hash, sizeof(key.file_hash));
+
+    hash = hash_bytes(&key.face_index, sizeof(key.face_index), hash);
+    hash = hash_bytes(&key.glyph_index, sizeof(key.glyph_index), hash);
+    return hash_bytes(&key.compile_hash, sizeof(key.compile_hash), hash);
+}
+
+static
+bool same_key(const store_slot_s & slot, const shared_glyph_key_s & key) {
+    return slot.file_hash == key.file_hash
+            && slot.face_index == key.face_index
+            && slot.glyph_index == key.glyph_index
+            && slot.compile_hash == key.compile_hash;
+}
+
+//a writer holds a slot while it copies one glyph, a writer that died
+//there leaves a slot that stays SLOT_WRITING
+static
+uint32_t wait_written(const store_slot_s & slot) {
+    uint32_t state = slot.state.load(std::memory_order_acquire);
+
+    for(int retry = 0; state == SLOT_WRITING && retry < WRITING_RETRY_COUNT; retry++) {
+        std::this_thread::yield();
+        state = slot.state.load(std::memory_order_acquire);
+    }
+
+    return state;
+}
+
+static
+uint64_t align_up(uint64_t v, uint64_t alignment) {
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+bool SharedGlyphStoreImpl::Open(const std::string & name, size_t size) {
+    try {
+        return Create(name, size);
+    } catch (const boost::interprocess::interprocess_exception & e) {
+        if (e.get_error_code() != boost::interprocess::already_exists_error) {
+            std::cerr << "could not create shared glyph store " << name << ":" << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    try {
+        return Attach(name);
+    } catch (const boost::interprocess::interprocess_exception & e) {
+        std::cerr << "could not open shared glyph store " << name << ":" << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool SharedGlyphStoreImpl::Create(const std::string & name, size_t size) {
+    m_Memory = boost::interprocess::shared_memory_object(boost::interprocess::create_only,
+                                                         name.c_str(),
+                                                         boost::interprocess::read_write);
+
+    size_t slot_count = MIN_SLOT_COUNT;
+
+    while(slot_count < size / BYTES_PER_SLOT)
+        slot_count *= 2;
+
+    uint64_t slot_offset = align_up(sizeof(store_header_s), AREA_ALIGNMENT);
+    uint64_t blob_offset = align_up(slot_offset + slot_count * sizeof(store_slot_s), AREA_ALIGNMENT);
+
+    if (blob_offset >= size) {
+        std::cerr << "shared glyph store " << name << " of " << size << " bytes is too small" << std::endl;
+        boost::interprocess::shared_memory_object::remove(name.c_str());
+        return false;
+    }
+
+    //new shared memory reads as zeros, every slot starts SLOT_EMPTY
+    m_Memory.truncate(size);
+    m_Region = boost::interprocess::mapped_region(m_Memory, boost::interprocess::read_write);
+
+    uint8_t * base = static_cast<uint8_t *>(m_Region.get_address());
+
+    m_Header = new (base) store_header_s;
+    m_Slots = reinterpret_cast<store_slot_s *>(base + slot_offset);
+    m_Blobs = base + blob_offset;
+
+    memcpy(m_Header->magic, SHARED_GLYPH_STORE_MAGIC, sizeof(m_Header->magic));
+    m_Header->version = SHARED_GLYPH_STORE_VERSION;
+    m_Header->slot_count = slot_count;
+    m_Header->slot_offset = slot_offset;
+    m_Header->blob_offset = blob_offset;
+    m_Header->blob_size = size - blob_offset;
+    m_Header->blob_top.store(0, std::memory_order_relaxed);
+    m_Header->ready.store(1, std::memory_order_release);
+    return true;
+}
+
+bool SharedGlyphStoreImpl::Attach(const std::string & name) {
+    m_Memory = boost::interprocess::shared_memory_object(boost::interprocess::open_only,
+                                                         name.c_str(),
+                                                         boost::interprocess::read_write);
+
+    //the creator may not have sized and laid out the store yet
+    for(int retry = 0; retry < OPEN_RETRY_COUNT; retry++) {
+        boost::interprocess::offset_t size = 0;
+
+        if (!m_Region.get_address()
+            && m_Memory.get_size(size)
+            && size >= static_cast<boost::interprocess::offset_t>(sizeof(store_header_s)))
+            m_Region = boost::interprocess::mapped_region(m_Memory, boost::interprocess::read_write);
+
+        if (m_Region.get_address()) {
+            m_Header = static_cast<store_header_s *>(m_Region.get_address());
+
+            if (m_Header->ready.load(std::memory_order_acquire))
+                break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    if (!m_Header || !m_Header->ready.load(std::memory_order_acquire)) {
+        std::cerr << "shared glyph store " << name << " was never laid out" << std::endl;
+        return false;
+    }
+
+    //the store may come from another build or be damaged, lookups must
+    //stay inside the region whatever the header says
+    uint64_t region_size = m_Region.get_size();
+    uint32_t slot_count = m_Header->slot_count;
+    uint64_t slot_offset = m_Header->slot_offset;
+    uint64_t blob_offset = m_Header->blob_offset;
+
+    if (memcmp(m_Header->magic, SHARED_GLYPH_STORE_MAGIC, sizeof(m_Header->magic))
+        || m_Header->version != SHARED_GLYPH_STORE_VERSION
+        || !slot_count || (slot_count & (slot_count - 1))
+        || slot_offset % AREA_ALIGNMENT || blob_offset % AREA_ALIGNMENT
+        || slot_offset < sizeof(store_header_s)
+        || slot_offset > blob_offset || blob_offset > region_size
+        || (blob_offset - slot_offset) / sizeof(store_slot_s) < slot_count
+        || m_Header->blob_size != region_size - blob_offset) {
+        std::cerr << "shared glyph store " << name << " has another layout" << std::endl;
+        return false;
+    }
+
+    uint8_t * base = static_cast<uint8_t *>(m_Region.get_address());
+
+    m_Slots = reinterpret_cast<store_slot_s *>(base + m_Header->slot_offset);
+    m_Blobs = base + m_Header->blob_offset;
+    return true;
+}
+
+bool SharedGlyphStoreImpl::Fill(const store_slot_s & slot, shared_glyph_s & glyph) const {
+    if (slot.offset % BLOB_ALIGNMENT
+        || slot.offset > m_Header->blob_size
+        || slot.size > m_Header->blob_size - slot.offset)
+        return false;
+
+    glyph.advance_x = slot.advance_x;
+    glyph.advance_y = slot.advance_y;
+    glyph.addr = slot.size ? m_Blobs + slot.offset : nullptr;
+    glyph.size = slot.size;
+    return true;
+}
+
+bool SharedGlyphStoreImpl::Find(const shared_glyph_key_s & key, shared_glyph_s & glyph) {
+    uint32_t mask = m_Header->slot_count - 1;
+    uint32_t index = hash_key(key) & mask;
+
+    for(uint32_t probe = 0; probe <= mask; probe++, index = (index + 1) & mask) {
+        const auto & slot = m_Slots[index];
+        //a slot still being written is skipped
+        uint32_t state = wait_written(slot);
+
+        if (state == SLOT_EMPTY)
+            return false;
+
+        if (state == SLOT_READY && same_key(slot, key))
+            return Fill(slot, glyph);
+    }
+
+    return false;
+}
+
+bool SharedGlyphStoreImpl::Add(const shared_glyph_key_s & key,
+                               float advance_x, float advance_y,
+                               const uint8_t * addr, size_t size,
+                               shared_glyph_s & glyph) {
+    uint32_t mask = m_Header->slot_count - 1;
+    uint32_t index = hash_key(key) & mask;
+
+    for(uint32_t probe = 0; probe <= mask;) {
+        auto & slot = m_Slots[index];
+        uint32_t state = wait_written(slot);
+
+        //the slot may be getting the same key, claiming another one
+        //would add the glyph twice
+        if (state == SLOT_WRITING)
+            return false;
+
+        //another process compiled the same glyph first, its copy wins
+        if (state == SLOT_READY && same_key(slot, key))
+            return Fill(slot, glyph);
+
+        if (state != SLOT_EMPTY) {
+            probe++;
+            index = (index + 1) & mask;
+            continue;
+        }
+
+        //a full store claims no more slots
+        if (m_Header->blob_top.load(std::memory_order_relaxed) + size > m_Header->blob_size)
+            return false;
+
+        //lost the slot to another process, look at what it holds now
+        if (!slot.state.compare_exchange_strong(state, SLOT_WRITING, std::memory_order_acquire))
+            continue;
+
+        //space is only taken for a claimed slot, so a lost race wastes none
+        uint64_t offset = 0;
+
+        if (size) {
+            offset = m_Header->blob_top.fetch_add(align_up(size, BLOB_ALIGNMENT), std::memory_order_relaxed);
+
+            if (offset + size > m_Header->blob_size) {
+                slot.state.store(SLOT_ABANDONED, std::memory_order_release);
+                return false;
+            }
+
+            memcpy(m_Blobs + offset, addr, size);
+        }
+
+        slot.face_index = key.face_index;
+        slot.glyph_index = key.glyph_index;
+        slot.size = size;
+        slot.file_hash = key.file_hash;
+        slot.compile_hash = key.compile_hash;
+        slot.offset = offset;
+        slot.advance_x = advance_x;
+        slot.advance_y = advance_y;
+        slot.state.store(SLOT_READY, std::memory_order_release);
+
+        return Fill(slot, glyph);
+    }
+
+    return false;
+}
+
+SharedGlyphStorePtr CreateSharedGlyphStore(const std::string & name, size_t size) {
+    auto store = std::make_shared<SharedGlyphStoreImpl>();
+
+    if (!store->Open(name, size))
+        return SharedGlyphStorePtr {};
+
+    return store;
+}
+
+bool RemoveSharedGlyphStore(const std::string & name) {
+    return boost::interprocess::shared_memory_object::remove(name.c_str());
+}
+
+} //namespace impl
+} //namespace ftdgl
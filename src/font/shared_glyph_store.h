@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstdint>
+
+namespace ftdgl {
+namespace impl {
+
+//a compiled glyph is the same for every process using the same face,
+//glyph index and compile settings
+typedef struct __shared_glyph_key_s {
+    uint64_t file_hash;
+    uint32_t face_index;
+    uint32_t glyph_index;
+    //size, dpi and load flags the glyph was compiled with
+    uint64_t compile_hash;
+} shared_glyph_key_s;
+
+//addr points into the shared region, nullptr for glyphs without outline
+typedef struct __shared_glyph_s {
+    float advance_x;
+    float advance_y;
+    uint8_t * addr;
+    size_t size;
+} shared_glyph_s;
+
+//compiled glyph geometry in named shared memory, one process compiles a
+//glyph and every process mapping the store uses it in place, the index is
+//an open addressing table whose slots are claimed with compare and swap
+class SharedGlyphStore {
+public:
+    SharedGlyphStore() = default;
+    virtual ~SharedGlyphStore() = default;
+
+public:
+    virtual bool Find(const shared_glyph_key_s & key, shared_glyph_s & glyph) = 0;
+    //copy size bytes of geometry at addr into the store, glyph gets the
+    //shared copy, or the copy of a process that added the key first,
+    //false when the store is full or a slot on the way of the key stays
+    //being written, the caller then keeps its own copy
+    virtual bool Add(const shared_glyph_key_s & key,
+                     float advance_x, float advance_y,
+                     const uint8_t * addr, size_t size,
+                     shared_glyph_s & glyph) = 0;
+};
+
+using SharedGlyphStorePtr = std::shared_ptr<SharedGlyphStore>;
+
+//open the store or create it with size bytes, empty on failure
+SharedGlyphStorePtr CreateSharedGlyphStore(const std::string & name, size_t size);
+bool RemoveSharedGlyphStore(const std::string & name);
+
+uint64_t hash_bytes(const void * data, size_t size, uint64_t seed = 0);
+
+} //namespace impl
+} //namespace ftdgl
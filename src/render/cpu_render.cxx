@@ -0,0 +1,351 @@
+#include "cpu_render.h"
+
+#include "antialias_tier.h"
+#include "thread_pool.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+namespace ftdgl {
+namespace render {
+namespace impl {
+
+//rows rendered by one task
+constexpr int BAND_HEIGHT = 16;
+
+//lcd samples pack 4 bit front and back counters into one of three
+//channels, gray samples count front and back faces in two
+constexpr int MAX_CHANNELS = 3;
+
+typedef struct __glyph_run_s {
+    const float * vertices;
+    uint32_t vertex_count;
+    //bounds of the geometry around the glyph origin, x0, y0, x1, y1
+    float bounds[4];
+} glyph_run_s;
+
+typedef struct __band_entry_s {
+    uint32_t run;
+    float x;
+    float y;
+} band_entry_s;
+
+//a glyph triangle at viewport pixels
+typedef struct __triangle_s {
+    float x[3];
+    float y[3];
+    float u[3];
+    float v[3];
+    float area;
+    float side;
+    //samples exactly on an edge count for one of the triangles sharing it
+    bool tie[3];
+} triangle_s;
+
+using band_entry_vector = std::vector<band_entry_s>;
+
+class CpuRenderImpl : public CpuRender {
+public:
+    CpuRenderImpl(const viewport::viewport_s & viewport, size_t thread_count)
+        : m_Viewport {viewport}
+        , m_Antialias {viewport.antialias >= 0 && viewport.antialias < text::ANTIALIAS_TIER_COUNT
+                       ? viewport.antialias : viewport::ANTIALIAS_LCD_6X}
+        , m_Tier {text::ANTIALIAS_TIERS[m_Antialias]}
+        , m_Pool {util::CreateThreadPool(thread_count)}
+        , m_Runs {}
+        , m_Bands {}
+        , m_Accumulation {} {
+    }
+
+    virtual ~CpuRenderImpl() = default;
+
+public:
+    virtual bool RenderLayout(text::TextLayoutPtr layout, image_s & image);
+
+private:
+    void CollectRuns(text::TextLayout & layout);
+    void RenderBand(text::TextLayout & layout, image_s & image, int band);
+    void AccumulateTriangle(const triangle_s & triangle, int row0, int row1);
+    void BlendRects(const text::text_attr_s * attrs, uint32_t count,
+                    image_s & image, int row0, int row1, bool foreground);
+    void Coverage(int x, int y, float * coverage) const;
+
+    const viewport::viewport_s & m_Viewport;
+    int m_Antialias;
+    const text::antialias_tier_s & m_Tier;
+    util::ThreadPoolPtr m_Pool;
+
+    //distinct glyphs of the layout and the instances overlapping each band
+    std::vector<glyph_run_s> m_Runs;
+    std::vector<band_entry_vector> m_Bands;
+    //one plane per accumulation channel, viewport sized
+    std::vector<uint8_t> m_Accumulation[MAX_CHANNELS];
+};
+
+static
+float edge(float ax, float ay, float bx, float by, float px, float py) {
+    return (bx - ax) * (py - ay) - (px - ax) * (by - ay);
+}
+
+static
+int channel_index(const glm::vec4 & channel) {
+    return channel.y > 0 ? 1 : channel.z > 0 ? 2 : 0;
+}
+
+void CpuRenderImpl::CollectRuns(text::TextLayout & layout) {
+    const text::glyph_instance_s * instances = layout.GetGlyphInstances();
+    size_t instance_count = layout.GetGlyphInstanceCount();
+    int band_count = (m_Viewport.height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+
+    m_Runs.clear();
+    m_Bands.resize(band_count);
+
+    for(auto & band : m_Bands)
+        band.clear();
+
+    //instances are sorted by glyph, so the bounds of each glyph are
+    //computed once
+    for(size_t i = 0; i < instance_count; i++) {
+        auto key = instances[i].key;
+
+        if (!i || instances[i - 1].key != key) {
+            const auto & glyphs = layout.GetFont(key >> text::GLYPH_ID_BITS)->GetGlyphTable();
+            auto id = key & text::GLYPH_ID_MASK;
+
+            glyph_run_s run {reinterpret_cast<const float *>(glyphs.Addr(id)),
+                             glyphs.VertexCount(id), {0, 0, 0, 0}};
+
+            for(uint32_t v = 0; v < run.vertex_count; v++) {
+                const float * vertex = run.vertices + v * 4;
+
+                run.bounds[0] = v ? std::min(run.bounds[0], vertex[0]) : vertex[0];
+                run.bounds[1] = v ? std::min(run.bounds[1], vertex[1]) : vertex[1];
+                run.bounds[2] = v ? std::max(run.bounds[2], vertex[0]) : vertex[0];
+                run.bounds[3] = v ? std::max(run.bounds[3], vertex[1]) : vertex[1];
+            }
+
+            m_Runs.push_back(run);
+        }
+
+        const auto & run = m_Runs.back();
+
+        if (!run.vertex_count)
+            continue;
+
+        //one more pixel around covers the jitter
+        int band0 = std::max<int>(0, floor((instances[i].y + run.bounds[1] - 1) / BAND_HEIGHT));
+        int band1 = std::min<int>(band_count - 1, floor((instances[i].y + run.bounds[3] + 1) / BAND_HEIGHT));
+
+        for(int band = band0; band <= band1; band++)
+            m_Bands[band].push_back({static_cast<uint32_t>(m_Runs.size() - 1),
+                                     instances[i].x, instances[i].y});
+    }
+}
+
+void CpuRenderImpl::AccumulateTriangle(const triangle_s & t, int row0, int row1) {
+    int width = m_Viewport.width;
+    float min_x = std::min({t.x[0], t.x[1], t.x[2]});
+    float max_x = std::max({t.x[0], t.x[1], t.x[2]});
+    float min_y = std::min({t.y[0], t.y[1], t.y[2]});
+    float max_y = std::max({t.y[0], t.y[1], t.y[2]});
+
+    //the jitter moves samples by less than a pixel
+    int x0 = std::max<int>(0, floor(min_x) - 1);
+    int x1 = std::min<int>(width, ceil(max_x) + 1);
+    int y0 = std::max<int>(row0, floor(min_y) - 1);
+    int y1 = std::min<int>(row1, ceil(max_y) + 1);
+
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    for(uint32_t s = 0; s < m_Tier.samples; s++) {
+        //the gpu moves the glyph by half the jitter instead
+        float offset_x = 0.5f - m_Tier.jitter[s].x * 0.5f;
+        float offset_y = 0.5f - m_Tier.jitter[s].y * 0.5f;
+        const auto & count = t.area > 0 ? m_Tier.front[s] : m_Tier.back[s];
+        int channel = channel_index(count);
+        int weight = count[channel];
+        uint8_t * plane = m_Accumulation[channel].data();
+
+        for(int y = y0; y < y1; y++) {
+            uint8_t * row = plane + y * width;
+            float py = y + offset_y;
+
+            //no branches or loop carried state, so the compiler can
+            //vectorize the span
+            for(int x = x0; x < x1; x++) {
+                float px = x + offset_x;
+                float w0 = edge(t.x[1], t.y[1], t.x[2], t.y[2], px, py);
+                float w1 = edge(t.x[2], t.y[2], t.x[0], t.y[0], px, py);
+                float w2 = edge(t.x[0], t.y[0], t.x[1], t.y[1], px, py);
+                float s0 = w0 * t.side, s1 = w1 * t.side, s2 = w2 * t.side;
+
+                bool inside = (s0 > 0 || (s0 == 0 && t.tie[0]))
+                        & (s1 > 0 || (s1 == 0 && t.tie[1]))
+                        & (s2 > 0 || (s2 == 0 && t.tie[2]));
+
+                float u = (w0 * t.u[0] + w1 * t.u[1] + w2 * t.u[2]) / t.area;
+                float v = (w0 * t.v[0] + w1 * t.v[1] + w2 * t.v[2]) / t.area;
+
+                inside &= u * u - v <= 0;
+
+                int value = row[x] + (inside ? weight : 0);
+                row[x] = static_cast<uint8_t>(std::min(value, 255));
+            }
+        }
+    }
+}
+
+void CpuRenderImpl::Coverage(int x, int y, float * coverage) const {
+    if (m_Antialias != viewport::ANTIALIAS_LCD_6X) {
+        size_t i = y * m_Viewport.width + x;
+        float samples = m_Tier.samples;
+        float count = std::abs(m_Accumulation[0][i] - m_Accumulation[1][i]);
+
+        coverage[0] = coverage[1] = coverage[2] = std::min(count, samples) / samples;
+        return;
+    }
+
+    auto alpha = [this, y](int channel, int x, float limit) -> float {
+        if (x >= m_Viewport.width)
+            return 0;
+
+        int value = m_Accumulation[channel][y * m_Viewport.width + x];
+        return std::min<float>(std::abs((value >> 4) - (value & 15)), limit);
+    };
+
+    //samples for 0, +1/3 and +2/3, then -2/3 and -1/3 from the next pixel
+    float r0 = alpha(0, x, 2), r1 = alpha(1, x, 2), r2 = alpha(2, x, 2);
+    float l0 = alpha(1, x + 1, 2), l1 = alpha(2, x + 1, 2);
+
+    coverage[0] = (r0 + r1 + r2) / 6;
+    coverage[1] = (l1 + r0 + r1) / 6;
+    coverage[2] = (l0 + l1 + r0) / 6;
+}
+
+void CpuRenderImpl::BlendRects(const text::text_attr_s * attrs, uint32_t count,
+                               image_s & image, int row0, int row1, bool foreground) {
+    auto to_byte = [](float v) {
+        return static_cast<uint8_t>(std::min(std::max(v, 0.f), 1.f) * 255 + 0.5f);
+    };
+
+    for(uint32_t i = 0; i < count; i++) {
+        const auto & attr = attrs[i];
+
+        //pixels with the center inside the rect
+        int x0 = std::max<int>(0, ceil(attr.bounds[0] * m_Viewport.width - 0.5f));
+        int x1 = std::min<int>(m_Viewport.width, ceil(attr.bounds[2] * m_Viewport.width - 0.5f));
+        int y0 = std::max<int>(row0, ceil(attr.bounds[1] * m_Viewport.height - 0.5f));
+        int y1 = std::min<int>(row1, ceil(attr.bounds[3] * m_Viewport.height - 0.5f));
+
+        const float * color = foreground ? attr.color : attr.back_color;
+
+        for(int y = y0; y < y1; y++) {
+            uint8_t * pixel = &image.pixels[(y * image.width + x0) * 4];
+
+            for(int x = x0; x < x1; x++, pixel += 4) {
+                float coverage[4] = {color[3], color[3], color[3], color[3]};
+
+                //the text scales its color by the coverage of every channel
+                //and keeps the destination alpha
+                if (foreground) {
+                    Coverage(x, y, coverage);
+                    coverage[3] = 0;
+                }
+
+                for(int c = 0; c < 4; c++) {
+                    float src = foreground ? color[c] * coverage[c] : color[c] * color[3];
+                    float dst = pixel[c] / 255.f;
+
+                    pixel[c] = to_byte(src + dst * (1 - coverage[c]));
+                }
+            }
+        }
+    }
+}
+
+void CpuRenderImpl::RenderBand(text::TextLayout & layout, image_s & image, int band) {
+    int width = m_Viewport.width;
+    int row0 = band * BAND_HEIGHT;
+    int row1 = std::min(m_Viewport.height, row0 + BAND_HEIGHT);
+    size_t channels = m_Antialias == viewport::ANTIALIAS_LCD_6X ? 3 : 2;
+
+    for(size_t c = 0; c < channels; c++)
+        std::fill(m_Accumulation[c].begin() + row0 * width,
+                  m_Accumulation[c].begin() + row1 * width, 0);
+
+    for(const auto & entry : m_Bands[band]) {
+        const auto & run = m_Runs[entry.run];
+
+        for(uint32_t v = 0; v + 2 < run.vertex_count; v += 3) {
+            const float * vertex = run.vertices + v * 4;
+            triangle_s t;
+
+            for(int i = 0; i < 3; i++) {
+                t.x[i] = vertex[i * 4] + entry.x;
+                t.y[i] = vertex[i * 4 + 1] + entry.y;
+                t.u[i] = vertex[i * 4 + 2];
+                t.v[i] = vertex[i * 4 + 3];
+            }
+
+            t.area = edge(t.x[0], t.y[0], t.x[1], t.y[1], t.x[2], t.y[2]);
+
+            if (t.area == 0)
+                continue;
+
+            t.side = t.area > 0 ? 1 : -1;
+
+            //edge i is opposite vertex i
+            for(int i = 0; i < 3; i++) {
+                int a = (i + 1) % 3, b = (i + 2) % 3;
+                float dx = (t.x[b] - t.x[a]) * t.side;
+                float dy = (t.y[b] - t.y[a]) * t.side;
+
+                t.tie[i] = dy < 0 || (dy == 0 && dx > 0);
+            }
+
+            AccumulateTriangle(t, row0, row1);
+        }
+    }
+
+    BlendRects(layout.GetBackgroundAttr(), layout.GetBackgroundAttrCount(), image, row0, row1, false);
+    BlendRects(layout.GetTextAttr(), layout.GetTextAttrCount(), image, row0, row1, true);
+}
+
+bool CpuRenderImpl::RenderLayout(text::TextLayoutPtr layout, image_s & image) {
+    if (!layout || m_Viewport.width <= 0 || m_Viewport.height <= 0)
+        return false;
+
+    layout->Finish();
+
+    if (image.width != m_Viewport.width || image.height != m_Viewport.height) {
+        image.width = m_Viewport.width;
+        image.height = m_Viewport.height;
+        image.pixels.assign(image.width * image.height * 4, 0);
+    }
+
+    size_t area = m_Viewport.width * m_Viewport.height;
+
+    for(auto & plane : m_Accumulation) {
+        if (plane.size() != area)
+            plane.assign(area, 0);
+    }
+
+    CollectRuns(*layout);
+
+    m_Pool->Run(m_Bands.size(), [this, &layout, &image](size_t band) {
+            RenderBand(*layout, image, band);
+        });
+
+    return true;
+}
+
+} //namespace impl
+
+CpuRenderPtr CreateCpuRender(const viewport::viewport_s & viewport, size_t thread_count) {
+    return std::make_shared<impl::CpuRenderImpl>(viewport, thread_count);
+}
+
+} //namespace render
+} //namespace ftdgl
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "text_layout.h"
+
+namespace ftdgl {
+namespace render {
+
+//8 bit rgba pixels, rows bottom up like a GL read back
+typedef struct __image_s {
+    int width;
+    int height;
+    std::vector<uint8_t> pixels;
+} image_s;
+
+//the texture render mode without a GL context, glyph triangles are
+//accumulated per jitter sample into the same front and back face
+//counters, then resolved and blended like the composite programs, for
+//servers without a gpu and as a reference for golden images
+class CpuRender {
+public:
+    CpuRender() = default;
+    virtual ~CpuRender() = default;
+
+public:
+    //blend the backgrounds, then the text of layout over image, image is
+    //resized to the viewport and cleared to transparent when it differs,
+    //layout is finished first when needed
+    virtual bool RenderLayout(text::TextLayoutPtr layout, image_s & image) = 0;
+};
+
+using CpuRenderPtr = std::shared_ptr<CpuRender>;
+
+//rows are split into bands rendered on thread_count threads, 0 means one
+//per hardware thread
+CpuRenderPtr CreateCpuRender(const viewport::viewport_s & viewport, size_t thread_count = 0);
+
+} //namespace render
+} //namespace ftdgl
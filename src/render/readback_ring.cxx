@@ -0,0 +1,277 @@
+#include "readback_ring.h"
+
+#include "opengl.h"
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <cstring>
+
+namespace ftdgl {
+namespace render {
+namespace impl {
+
+typedef struct __readback_slot_s {
+    GLuint frame_buffer;
+    GLuint texture;
+    GLuint pixel_buffer;
+    //set while the read back is in flight
+    GLsync fence;
+    uint64_t frame;
+    readback_callback callback;
+} readback_slot_s;
+
+class ReadbackRingImpl : public ReadbackRing {
+public:
+    ReadbackRingImpl(int width, int height, size_t depth)
+        : m_Width {width}
+        , m_Height {height}
+        , m_Slots(depth)
+        , m_InFlight {}
+        , m_Next {0}
+        , m_Frame {0}
+        , m_Begun {false}
+        , m_OldFrameBuffer {0}
+        , m_OldViewport {0, 0, 0, 0}
+        , m_Pixels {} {
+    }
+
+    virtual ~ReadbackRingImpl() {
+        Destroy();
+    }
+
+public:
+    virtual bool Begin(const float * clear_color);
+    virtual uint64_t Submit(readback_callback callback);
+    virtual size_t Poll();
+    virtual void Flush();
+
+    bool Init();
+
+private:
+    void Destroy();
+    //copy the pixel buffer of the oldest frame in flight and call its
+    //callback, wait for its fence when wait is set
+    bool Complete(bool wait);
+
+    int m_Width;
+    int m_Height;
+    std::vector<readback_slot_s> m_Slots;
+    //slot indices in submit order
+    std::deque<size_t> m_InFlight;
+    size_t m_Next;
+    uint64_t m_Frame;
+
+    bool m_Begun;
+    GLint m_OldFrameBuffer;
+    GLint m_OldViewport[4];
+    //kept between frames so the copy for a callback does not allocate
+    std::vector<uint8_t> m_Pixels;
+};
+
+bool ReadbackRingImpl::Init() {
+    GLint old_frame_buffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_frame_buffer);
+
+    bool complete = true;
+
+    for(auto & slot : m_Slots) {
+        slot.fence = 0;
+        slot.frame = 0;
+
+	glGenTextures(1, &slot.texture);
+	glBindTexture(GL_TEXTURE_2D, slot.texture);
+	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGBA8, m_Width, m_Height, 0,GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &slot.frame_buffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, slot.frame_buffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, slot.texture, 0);
+
+	GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
+	glDrawBuffers(1, DrawBuffers);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "frame buffer status error:" << status << std::endl;
+		complete = false;
+	}
+
+        glGenBuffers(1, &slot.pixel_buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixel_buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, m_Width * m_Height * 4, nullptr, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, old_frame_buffer);
+    return complete;
+}
+
+void ReadbackRingImpl::Destroy() {
+    for(auto & slot : m_Slots) {
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+
+        glDeleteFramebuffers(1, &slot.frame_buffer);
+        glDeleteTextures(1, &slot.texture);
+        glDeleteBuffers(1, &slot.pixel_buffer);
+    }
+}
+
+bool ReadbackRingImpl::Complete(bool wait) {
+    if (m_InFlight.empty())
+        return false;
+
+    auto & slot = m_Slots[m_InFlight.front()];
+
+    //the first wait flushes, so the fence is sure to signal
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+
+    for(;;) {
+        GLenum result = glClientWaitSync(slot.fence, flags, wait ? 1000000000 : 0);
+
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+            break;
+
+        if (result == GL_WAIT_FAILED) {
+            std::cerr << "read back wait failed for frame " << slot.frame << std::endl;
+            break;
+        }
+
+        if (!wait)
+            return false;
+
+        flags = 0;
+    }
+
+    glDeleteSync(slot.fence);
+    slot.fence = 0;
+    m_InFlight.pop_front();
+
+    auto callback = std::move(slot.callback);
+    slot.callback = nullptr;
+
+    //the callback gets a copy with the buffer unmapped and the caller's
+    //binding back, so it may use GL and the ring, a nested Complete
+    //copies into a vector of its own
+    size_t size = m_Width * m_Height * 4;
+    std::vector<uint8_t> pixels;
+    GLint old_pack_buffer = 0;
+
+    pixels.swap(m_Pixels);
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &old_pack_buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixel_buffer);
+
+    const void * mapped = callback
+            ? glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT) : nullptr;
+
+    if (mapped) {
+        pixels.resize(size);
+        memcpy(pixels.data(), mapped, size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, old_pack_buffer);
+
+    if (mapped)
+        callback({slot.frame, m_Width, m_Height, pixels.data()});
+
+    m_Pixels.swap(pixels);
+    return true;
+}
+
+bool ReadbackRingImpl::Begin(const float * clear_color) {
+    if (m_Begun)
+        return false;
+
+    //frames finish in order, so the oldest one is the slot to reuse, a
+    //callback of the wait may Begin and Submit a frame itself and move on
+    //to the next slot
+    while(m_Slots[m_Next].fence)
+        Complete(true);
+
+    auto & slot = m_Slots[m_Next];
+
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &m_OldFrameBuffer);
+    glGetIntegerv(GL_VIEWPORT, m_OldViewport);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, slot.frame_buffer);
+    glViewport(0, 0, m_Width, m_Height);
+
+    if (clear_color) {
+        GLfloat old_clear_color[4];
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, old_clear_color);
+
+        glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glClearColor(old_clear_color[0], old_clear_color[1], old_clear_color[2], old_clear_color[3]);
+    }
+
+    m_Begun = true;
+    return true;
+}
+
+uint64_t ReadbackRingImpl::Submit(readback_callback callback) {
+    if (!m_Begun)
+        return 0;
+
+    auto & slot = m_Slots[m_Next];
+
+    //the copy into the pixel buffer is queued, not waited for
+    GLint old_pack_buffer = 0, old_pack_alignment = 4;
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &old_pack_buffer);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &old_pack_alignment);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixel_buffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, m_Width, m_Height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, old_pack_alignment);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, old_pack_buffer);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.frame = ++m_Frame;
+    slot.callback = std::move(callback);
+
+    m_InFlight.push_back(m_Next);
+    m_Next = (m_Next + 1) % m_Slots.size();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_OldFrameBuffer);
+    glViewport(m_OldViewport[0], m_OldViewport[1], m_OldViewport[2], m_OldViewport[3]);
+
+    m_Begun = false;
+    return slot.frame;
+}
+
+size_t ReadbackRingImpl::Poll() {
+    size_t count = 0;
+
+    while(Complete(false))
+        count++;
+
+    return count;
+}
+
+void ReadbackRingImpl::Flush() {
+    while(Complete(true)) {
+    }
+}
+
+} //namespace impl
+
+ReadbackRingPtr CreateReadbackRing(int width, int height, size_t depth) {
+    if (width <= 0 || height <= 0 || !depth)
+        return {};
+
+    auto ring = std::make_shared<impl::ReadbackRingImpl>(width, height, depth);
+
+    if (!ring->Init())
+        return {};
+
+    return ring;
+}
+
+} //namespace render
+} //namespace ftdgl
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <cstdint>
+#include <functional>
+
+namespace ftdgl {
+namespace render {
+
+//a finished frame, rgba rows bottom up, pixels are only valid inside the
+//callback, which may make GL calls and use the ring
+typedef struct __readback_frame_s {
+    uint64_t frame;
+    int width;
+    int height;
+    const uint8_t * pixels;
+} readback_frame_s;
+
+using readback_callback = std::function<void(const readback_frame_s & frame)>;
+
+//offscreen targets read back through pixel buffers and fences, so the
+//next frame renders while earlier ones are still copied, call on the GL
+//thread only
+class ReadbackRing {
+public:
+    ReadbackRing() = default;
+    virtual ~ReadbackRing() = default;
+
+public:
+    //bind the target of the next slot and its viewport, cleared to
+    //clear_color when given, the clear color in GL is kept, waits for
+    //the oldest frame when all slots are in flight
+    virtual bool Begin(const float * clear_color = nullptr) = 0;
+    //start the read back of the target bound by Begin and bind the frame
+    //buffer and viewport from before Begin again, the pack state is kept,
+    //callback runs from a later Begin, Poll or Flush
+    virtual uint64_t Submit(readback_callback callback) = 0;
+    //hand over the frames done so far in submit order without waiting,
+    //returns how many
+    virtual size_t Poll() = 0;
+    //wait for every frame in flight
+    virtual void Flush() = 0;
+};
+
+using ReadbackRingPtr = std::shared_ptr<ReadbackRing>;
+
+//depth targets of width x height, empty when the frame buffer fails
+ReadbackRingPtr CreateReadbackRing(int width, int height, size_t depth = 3);
+
+} //namespace render
+} //namespace ftdgl
@@ -5,15 +5,93 @@
 #include "opengl.h"
 
 #include "program.h"
+#include "upload_ring.h"
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
 
 namespace ftdgl {
 namespace render {
 namespace impl {
+
+//gpu side copy of the rects of one text buffer, uploaded again only
+//when the buffer generation changes
+typedef struct __buffer_state_s {
+    //tells a live buffer from a new one at a reused address
+    std::weak_ptr<text::TextBuffer> buffer;
+    uint64_t generation;
+    GLuint vertex_array;
+    GLuint background_vertex_array;
+    GLuint rect_buffer;
+    size_t rect_capacity;
+    //rects of buffers updated more than once are written here instead
+    //when persistent mapping is supported
+    util::UploadRingPtr rect_ring;
+    uint32_t update_count;
+} buffer_state_s;
+
+using buffer_state_map = std::unordered_map<const text::TextBuffer *, buffer_state_s>;
+
+//composite programs of one antialias tier, built on first use
+typedef struct __composite_program_s {
+    ProgramPtr program;
+    GLuint texture_index;
+    GLuint first_round_index;
+    GLuint transform_index;
+    //empty when dual source blending is missing
+    ProgramPtr dual_source;
+    GLuint dual_source_texture_index;
+    GLuint dual_source_transform_index;
+} composite_program_s;
+
+//gray samples of each viewport::antialias_e, 0 for lcd
+static
+const
+uint32_t ANTIALIAS_GRAY_SAMPLES[] = {0, 4, 1};
+
+constexpr int ANTIALIAS_COUNT = sizeof(ANTIALIAS_GRAY_SAMPLES) / sizeof(uint32_t);
+
+//foreground rect of a batch with the texture rect of its buffer
+typedef struct __batch_attr_s {
+    text::text_attr_s attr;
+    float texture_rect[4];
+} batch_attr_s;
+
+//foreground rects of a batch sampling the same texture
+typedef struct __batch_range_s {
+    GLuint texture;
+    int antialias;
+    size_t first;
+    size_t count;
+} batch_range_s;
+
+//rects of the last RenderTexts call, foreground rects grouped by texture
+//followed by the background rects, uploaded again only when the buffers
+//or their generations change
+typedef struct __batch_state_s {
+    std::vector<std::weak_ptr<text::TextBuffer>> buffers;
+    std::vector<uint64_t> generations;
+    std::vector<batch_range_s> ranges;
+    std::vector<batch_attr_s> fore_attrs;
+    std::vector<text::text_attr_s> back_attrs;
+    std::vector<size_t> order;
+    GLuint vertex_array;
+    GLuint background_vertex_array;
+    GLuint rect_buffer;
+    size_t rect_capacity;
+    util::UploadRingPtr rect_ring;
+    //rect_buffer or the ring buffer, and where the rects start in it
+    GLuint rect_source;
+    size_t rect_offset;
+} batch_state_s;
+
 class RenderImpl : public Render {
 public:
-    RenderImpl() {
+    RenderImpl(render_mode_e mode)
+        : m_Mode {mode} {
         Init();
     }
 
@@ -22,23 +100,45 @@ public:
     }
 
     virtual bool RenderText(text::TextBufferPtr text_buf);
+    virtual bool RenderTexts(const text::TextBufferPtr * text_bufs, size_t count);
+    virtual bool RenderText(text::TextBufferPtr text_buf,
+                            uint32_t target_fbo,
+                            const int32_t * dest_rect,
+                            const float * transform);
 
 private:
-    ProgramPtr m_Program;
+    render_mode_e m_Mode;
+    composite_program_s m_Composite[ANTIALIAS_COUNT];
+    bool m_DualSource;
     ProgramPtr m_ProgramBackground;
-    GLuint m_VertexArray;
+    ProgramPtr m_ProgramCover;
+    GLuint m_BackgroundTransformIndex;
+    GLuint m_CoverTransformIndex;
 	GLuint m_Vertexbuffer;
-    GLuint m_RectColorBuffer;
-    GLuint m_RenderTextureIndex;
-    GLuint m_FirstRoundIndex;
+
+    //clip space transform of all passes, column major
+    GLfloat m_Transform[9];
+
+    buffer_state_map m_BufferStates;
+    batch_state_s m_Batch;
 
 private:
-    void InitVertexArray(text::TextBufferPtr text_buf);
+    buffer_state_s & GetBufferState(text::TextBufferPtr text_buf);
+    void UpdateBufferState(text::TextBufferPtr text_buf, buffer_state_s & state);
+    void InitAttribPointers(GLuint vertex_array, GLuint rect_buffer, size_t offset, GLsizei stride);
+    void DestroyBufferState(buffer_state_s & state);
+    bool BatchChanged(const text::TextBufferPtr * text_bufs, size_t count) const;
+    void UpdateBatch(const text::TextBufferPtr * text_bufs, size_t count);
+    void InitBatchAttribPointers(size_t first);
     void Init();
     void Destroy();
+    void SetTransform(const float * transform);
 
-    void DrawBackground(text::TextBufferPtr text_buf);
-    void DrawForeground(text::TextBufferPtr text_buf);
+    void DrawBackground(GLuint vertex_array, size_t count);
+    const composite_program_s & GetCompositeProgram(int antialias);
+    void DrawForeground(GLuint vertex_array, GLuint texture, int antialias, size_t count);
+    void DrawStencil(const text::TextBufferPtr * text_bufs, size_t count);
+    void DrawCover(GLuint vertex_array, size_t count);
 };
 
 static
@@ -49,15 +149,106 @@ const GLfloat screen_quad[] = {
     1, 1
 };
 
-void RenderImpl::InitVertexArray(text::TextBufferPtr text_buf) {
+buffer_state_s & RenderImpl::GetBufferState(text::TextBufferPtr text_buf) {
+    auto it = m_BufferStates.find(text_buf.get());
+
+    if (it != m_BufferStates.end()) {
+        if (it->second.buffer.lock() == text_buf)
+            return it->second;
+
+        //the old buffer died and a new one got its address
+        DestroyBufferState(it->second);
+        m_BufferStates.erase(it);
+    }
+
+    //drop the state of buffers destroyed since, only when adding so an
+    //unchanged frame does not pay for it
+    for(auto i = m_BufferStates.begin(); i != m_BufferStates.end();) {
+        if (i->second.buffer.expired()) {
+            DestroyBufferState(i->second);
+            i = m_BufferStates.erase(i);
+        } else {
+            ++i;
+        }
+    }
+
+    buffer_state_s state {text_buf, 0, 0, 0, 0, 0, {}, 0};
+
+    glGenVertexArrays(1, &state.vertex_array);
+    glGenVertexArrays(1, &state.background_vertex_array);
+    glGenBuffers(1, &state.rect_buffer);
+
+    //out of date, so the first render uploads
+    state.generation = text_buf->GetGeneration() + 1;
+
+    return m_BufferStates[text_buf.get()] = state;
+}
+
+void RenderImpl::UpdateBufferState(text::TextBufferPtr text_buf, buffer_state_s & state) {
+    auto generation = text_buf->GetGeneration();
+
+	if (state.generation == generation)
+		return;
+
 	auto count = text_buf->GetTextAttrCount();
-	auto text_attr = text_buf->GetTextAttr();
+	auto back_count = text_buf->GetBackgroundAttrCount();
+    size_t size = sizeof(text::text_attr_s) * (count + back_count);
+    size_t fore_size = sizeof(text::text_attr_s) * count;
+
+    //static text keeps its rects in the plain buffer
+    if (!state.rect_ring && state.update_count == 1)
+        state.rect_ring = util::CreateUploadRing();
+
+    state.update_count++;
+
+    // foreground rects followed by background rects
+    GLuint rect_buffer = state.rect_buffer;
+    size_t offset = 0;
+    auto mapped = static_cast<uint8_t *>(state.rect_ring ? state.rect_ring->Map(size) : nullptr);
+
+    if (mapped) {
+        //a region of its own, draws of the old rects do not hold it up
+        memcpy(mapped, text_buf->GetTextAttr(), fore_size);
+        memcpy(mapped + fore_size, text_buf->GetBackgroundAttr(), size - fore_size);
+
+        rect_buffer = state.rect_ring->GetBuffer();
+        offset = state.rect_ring->GetOffset();
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, state.rect_buffer);
+
+        if (size > state.rect_capacity) {
+            glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+            state.rect_capacity = size;
+        }
+
+        glBufferSubData(GL_ARRAY_BUFFER, 0,
+                        fore_size,
+                        text_buf->GetTextAttr());
+        glBufferSubData(GL_ARRAY_BUFFER,
+                        fore_size,
+                        size - fore_size,
+                        text_buf->GetBackgroundAttr());
+    }
 
-    glBindVertexArray(m_VertexArray);
+    InitAttribPointers(state.vertex_array, rect_buffer,
+                       offset, sizeof(text::text_attr_s));
+    InitAttribPointers(state.background_vertex_array, rect_buffer,
+                       offset + fore_size, sizeof(text::text_attr_s));
+
+    state.generation = generation;
+}
+
+void RenderImpl::DestroyBufferState(buffer_state_s & state) {
+    glDeleteVertexArrays(1, &state.vertex_array);
+    glDeleteVertexArrays(1, &state.background_vertex_array);
+    glDeleteBuffers(1, &state.rect_buffer);
+    state.rect_ring.reset();
+}
+
+void RenderImpl::InitAttribPointers(GLuint vertex_array, GLuint rect_buffer, size_t offset, GLsizei stride) {
+    glBindVertexArray(vertex_array);
 
 	glBindBuffer(GL_ARRAY_BUFFER, m_Vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(screen_quad),
-                 screen_quad, GL_STATIC_DRAW);
 
     //position2
     glEnableVertexAttribArray(0);
@@ -65,10 +256,7 @@ void RenderImpl::InitVertexArray(text::TextBufferPtr text_buf) {
     glVertexAttribDivisor(0, 0);
 
     // color and rect
-	glBindBuffer(GL_ARRAY_BUFFER, m_RectColorBuffer);
-	glBufferData(GL_ARRAY_BUFFER,
-                 sizeof(text::text_attr_s) * count,
-                 text_attr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, rect_buffer);
 
     //back color
     glEnableVertexAttribArray(2);
@@ -76,8 +264,8 @@ void RenderImpl::InitVertexArray(text::TextBufferPtr text_buf) {
                           4,
                           GL_FLOAT,
                           GL_FALSE,
-                          sizeof(text::text_attr_s),
-                          reinterpret_cast<void*>(offsetof(text::text_attr_s, back_color)));
+                          stride,
+                          reinterpret_cast<void*>(offset + offsetof(text::text_attr_s, back_color)));
     glVertexAttribDivisor(2, 1);
 
     //fore color
@@ -86,8 +274,8 @@ void RenderImpl::InitVertexArray(text::TextBufferPtr text_buf) {
                           4,
                           GL_FLOAT,
                           GL_FALSE,
-                          sizeof(text::text_attr_s),
-                          reinterpret_cast<void*>(offsetof(text::text_attr_s, color)));
+                          stride,
+                          reinterpret_cast<void*>(offset + offsetof(text::text_attr_s, color)));
     glVertexAttribDivisor(3, 1);
 
     //rect
@@ -96,42 +284,203 @@ void RenderImpl::InitVertexArray(text::TextBufferPtr text_buf) {
                           4,
                           GL_FLOAT,
                           GL_FALSE,
-                          sizeof(text::text_attr_s),
-                          reinterpret_cast<void*>(offsetof(text::text_attr_s, bounds)));
+                          stride,
+                          reinterpret_cast<void*>(offset + offsetof(text::text_attr_s, bounds)));
     glVertexAttribDivisor(1, 1);
     glBindVertexArray(0);
 }
 
 void RenderImpl::Init() {
-    m_Program = CreateRenderProgram();
     m_ProgramBackground = CreateRenderBackgroundProgram();
+    m_BackgroundTransformIndex = glGetUniformLocation(*m_ProgramBackground, "transform");
+
+    if (m_Mode == RENDER_MODE_STENCIL) {
+        m_ProgramCover = CreateRenderCoverProgram();
+        m_CoverTransformIndex = glGetUniformLocation(*m_ProgramCover, "transform");
+    }
+
+    SetTransform(nullptr);
 
-    glGenVertexArrays(1, &m_VertexArray);
 	glGenBuffers(1, &m_Vertexbuffer);
-    glGenBuffers(1, &m_RectColorBuffer);
 
-    glUseProgram(*m_Program);
+	glBindBuffer(GL_ARRAY_BUFFER, m_Vertexbuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(screen_quad),
+                 screen_quad, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLint dual_source_buffers = 0;
+#ifdef GL_MAX_DUAL_SOURCE_DRAW_BUFFERS
+    glGetIntegerv(GL_MAX_DUAL_SOURCE_DRAW_BUFFERS, &dual_source_buffers);
+#endif
 
-    m_RenderTextureIndex = glGetUniformLocation(*m_Program, "texture_render");
-    m_FirstRoundIndex = glGetUniformLocation(*m_Program, "first_round");
+    m_DualSource = dual_source_buffers > 0;
 
-    glUseProgram(0);
+    //the tier of most buffers
+    GetCompositeProgram(viewport::ANTIALIAS_LCD_6X);
+
+    m_Batch.rect_capacity = 0;
+    m_Batch.rect_ring = util::CreateUploadRing();
+    m_Batch.rect_source = 0;
+    m_Batch.rect_offset = 0;
+
+    glGenVertexArrays(1, &m_Batch.vertex_array);
+    glGenVertexArrays(1, &m_Batch.background_vertex_array);
+    glGenBuffers(1, &m_Batch.rect_buffer);
 }
 
 void RenderImpl::Destroy() {
+    for(auto & it : m_BufferStates)
+        DestroyBufferState(it.second);
+
+    m_BufferStates.clear();
+
+    glDeleteVertexArrays(1, &m_Batch.vertex_array);
+    glDeleteVertexArrays(1, &m_Batch.background_vertex_array);
+    glDeleteBuffers(1, &m_Batch.rect_buffer);
+    m_Batch.rect_ring.reset();
+
     glDeleteBuffers(1, &m_Vertexbuffer);
-    glDeleteBuffers(1, &m_RectColorBuffer);
-    glDeleteVertexArrays(1, &m_VertexArray);
 }
 
-void RenderImpl::DrawBackground(text::TextBufferPtr text_buf) {
-	auto count = text_buf->GetTextAttrCount();
+bool RenderImpl::BatchChanged(const text::TextBufferPtr * text_bufs, size_t count) const {
+    if (m_Batch.buffers.size() != count)
+        return true;
+
+    for(size_t i = 0; i < count; i++) {
+        if (m_Batch.generations[i] != text_bufs[i]->GetGeneration()
+            || m_Batch.buffers[i].lock() != text_bufs[i])
+            return true;
+    }
+
+    return false;
+}
+
+void RenderImpl::UpdateBatch(const text::TextBufferPtr * text_bufs, size_t count) {
+    auto & batch = m_Batch;
+
+    batch.buffers.assign(text_bufs, text_bufs + count);
+    batch.generations.resize(count);
+    batch.order.resize(count);
+    batch.ranges.clear();
+    batch.fore_attrs.clear();
+    batch.back_attrs.clear();
+
+    for(size_t i = 0; i < count; i++) {
+        batch.generations[i] = text_bufs[i]->GetGeneration();
+        batch.order[i] = i;
+    }
+
+    //buffers leasing from the same pool page share a texture and a draw
+    std::stable_sort(batch.order.begin(), batch.order.end(),
+                     [text_bufs](size_t a, size_t b) {
+                         auto texture_a = text_bufs[a]->GetTexture();
+                         auto texture_b = text_bufs[b]->GetTexture();
+
+                         if (texture_a != texture_b)
+                             return texture_a < texture_b;
+
+                         return text_bufs[a]->GetAntialias() < text_bufs[b]->GetAntialias();
+                     });
+
+    for(auto i : batch.order) {
+        const auto & text_buf = text_bufs[i];
+        auto attr_count = text_buf->GetTextAttrCount();
+
+        if (!attr_count)
+            continue;
+
+        GLuint texture = text_buf->GetTexture();
+        int antialias = text_buf->GetAntialias();
+
+        if (batch.ranges.empty()
+            || batch.ranges.back().texture != texture
+            || batch.ranges.back().antialias != antialias)
+            batch.ranges.push_back({texture, antialias, batch.fore_attrs.size(), 0});
+
+        auto attrs = text_buf->GetTextAttr();
+        auto texture_rect = text_buf->GetTextureRect();
+
+        for(uint32_t j = 0; j < attr_count; j++) {
+            batch_attr_s attr;
+
+            attr.attr = attrs[j];
+            std::copy(texture_rect, texture_rect + 4, attr.texture_rect);
+
+            batch.fore_attrs.push_back(attr);
+        }
+
+        batch.ranges.back().count += attr_count;
+    }
+
+    //backgrounds keep the order of the buffers
+    for(size_t i = 0; i < count; i++) {
+        auto attrs = text_bufs[i]->GetBackgroundAttr();
+
+        batch.back_attrs.insert(batch.back_attrs.end(),
+                                attrs, attrs + text_bufs[i]->GetBackgroundAttrCount());
+    }
+
+    size_t fore_size = sizeof(batch_attr_s) * batch.fore_attrs.size();
+    size_t back_size = sizeof(text::text_attr_s) * batch.back_attrs.size();
+
+    auto mapped = static_cast<uint8_t *>(batch.rect_ring ? batch.rect_ring->Map(fore_size + back_size) : nullptr);
+
+    if (mapped) {
+        memcpy(mapped, batch.fore_attrs.data(), fore_size);
+        memcpy(mapped + fore_size, batch.back_attrs.data(), back_size);
+
+        batch.rect_source = batch.rect_ring->GetBuffer();
+        batch.rect_offset = batch.rect_ring->GetOffset();
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, batch.rect_buffer);
+
+        if (fore_size + back_size > batch.rect_capacity) {
+            glBufferData(GL_ARRAY_BUFFER, fore_size + back_size, nullptr, GL_DYNAMIC_DRAW);
+            batch.rect_capacity = fore_size + back_size;
+        }
+
+        glBufferSubData(GL_ARRAY_BUFFER, 0, fore_size, batch.fore_attrs.data());
+        glBufferSubData(GL_ARRAY_BUFFER, fore_size, back_size, batch.back_attrs.data());
+
+        batch.rect_source = batch.rect_buffer;
+        batch.rect_offset = 0;
+    }
+
+    InitAttribPointers(batch.background_vertex_array, batch.rect_source,
+                       batch.rect_offset + fore_size, sizeof(text::text_attr_s));
+}
+
+void RenderImpl::InitBatchAttribPointers(size_t first) {
+    size_t offset = m_Batch.rect_offset + sizeof(batch_attr_s) * first;
+
+    InitAttribPointers(m_Batch.vertex_array, m_Batch.rect_source,
+                       offset + offsetof(batch_attr_s, attr), sizeof(batch_attr_s));
+
+    glBindVertexArray(m_Batch.vertex_array);
+	glBindBuffer(GL_ARRAY_BUFFER, m_Batch.rect_source);
+
+    //texture rect
+    glEnableVertexAttribArray(4);
+	glVertexAttribPointer(4,
+                          4,
+                          GL_FLOAT,
+                          GL_FALSE,
+                          sizeof(batch_attr_s),
+                          reinterpret_cast<void*>(offset + offsetof(batch_attr_s, texture_rect)));
+    glVertexAttribDivisor(4, 1);
+    glBindVertexArray(0);
+}
+
+void RenderImpl::DrawBackground(GLuint vertex_array, size_t count) {
+	if (!count)
+		return;
 
 	//draw background
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glUseProgram (*m_ProgramBackground);
+    glUniformMatrix3fv(m_BackgroundTransformIndex, 1, GL_FALSE, m_Transform);
 
-    glBindVertexArray(m_VertexArray);
+    glBindVertexArray(vertex_array);
 
     glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0,
                           sizeof(screen_quad) / sizeof(GLfloat) / 2,
@@ -141,22 +490,74 @@ void RenderImpl::DrawBackground(text::TextBufferPtr text_buf) {
     glUseProgram(0);
 }
 
-void RenderImpl::DrawForeground(text::TextBufferPtr text_buf) {
-	auto count = text_buf->GetTextAttrCount();
+const composite_program_s & RenderImpl::GetCompositeProgram(int antialias) {
+    if (antialias < 0 || antialias >= ANTIALIAS_COUNT)
+        antialias = viewport::ANTIALIAS_LCD_6X;
 
-	//draw foreground
-	GLuint render_texture = text_buf->GetTexture();
+    auto & composite = m_Composite[antialias];
+
+    if (composite.program)
+        return composite;
+
+    auto gray_samples = ANTIALIAS_GRAY_SAMPLES[antialias];
+
+    composite.program = CreateRenderProgram(gray_samples);
+
+    glUseProgram(*composite.program);
+
+    composite.texture_index = glGetUniformLocation(*composite.program, "texture_render");
+    composite.first_round_index = glGetUniformLocation(*composite.program, "first_round");
+    composite.transform_index = glGetUniformLocation(*composite.program, "transform");
+
+    if (m_DualSource) {
+        composite.dual_source = CreateRenderDualSourceProgram(gray_samples);
+
+        glUseProgram(*composite.dual_source);
+        composite.dual_source_texture_index = glGetUniformLocation(*composite.dual_source, "texture_render");
+        composite.dual_source_transform_index = glGetUniformLocation(*composite.dual_source, "transform");
+    }
+
+    glUseProgram(0);
+
+    return composite;
+}
+
+void RenderImpl::DrawForeground(GLuint vertex_array, GLuint render_texture, int antialias, size_t count) {
+    const auto & composite = GetCompositeProgram(antialias);
+
+    if (composite.dual_source) {
+        //dst = color * coverage + dst * (1 - coverage) in one pass
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC1_COLOR);
+        glUseProgram(*composite.dual_source);
+        glUniformMatrix3fv(composite.dual_source_transform_index, 1, GL_FALSE, m_Transform);
+
+        glBindVertexArray(vertex_array);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, render_texture);
+        glUniform1i(composite.dual_source_texture_index, 0);
 
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0,
+                              sizeof(screen_quad) / sizeof(GLfloat) / 2,
+                              count);
+
+        glUseProgram(0);
+        glBindVertexArray(0);
+        return;
+    }
+
+	//draw foreground
 	glBlendFunc(GL_ZERO, GL_SRC_COLOR);
-	glUseProgram (*m_Program);
+	glUseProgram (*composite.program);
+    glUniformMatrix3fv(composite.transform_index, 1, GL_FALSE, m_Transform);
 
-    glBindVertexArray(m_VertexArray);
+    glBindVertexArray(vertex_array);
 
-	glUniform1f(m_FirstRoundIndex, 1.0);
+	glUniform1f(composite.first_round_index, 1.0);
 
 	glActiveTexture (GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, render_texture);
-	glUniform1i(m_RenderTextureIndex, 0);
+	glUniform1i(composite.texture_index, 0);
 
 	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0,
                           sizeof(screen_quad) / sizeof(GLfloat) / 2,
@@ -164,7 +565,7 @@ void RenderImpl::DrawForeground(text::TextBufferPtr text_buf) {
 
 	glBlendFunc(GL_ONE, GL_ONE);
 
-	glUniform1f(m_FirstRoundIndex, 0.0);
+	glUniform1f(composite.first_round_index, 0.0);
 
 	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0,
                           sizeof(screen_quad) / sizeof(GLfloat) / 2,
@@ -174,24 +575,177 @@ void RenderImpl::DrawForeground(text::TextBufferPtr text_buf) {
     glBindVertexArray(0);
 }
 
+void RenderImpl::DrawStencil(const text::TextBufferPtr * text_bufs, size_t count) {
+    //non zero winding, front faces count up and back faces down
+    glEnable(GL_STENCIL_TEST);
+    glStencilMask(0xff);
+    glStencilFunc(GL_ALWAYS, 0, 0xff);
+    glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+    glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    for(size_t i = 0; i < count; i++)
+        text_bufs[i]->DrawGlyphs(m_Transform);
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDisable(GL_STENCIL_TEST);
+}
+
+void RenderImpl::DrawCover(GLuint vertex_array, size_t count) {
+    //fill where the winding is set and reset it under the rect, so
+    //overlapping rects fill a pixel only once, ClearGlyphStencil resets
+    //the winding of outlines reaching past the rects
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_NOTEQUAL, 0, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glUseProgram (*m_ProgramCover);
+    glUniformMatrix3fv(m_CoverTransformIndex, 1, GL_FALSE, m_Transform);
+
+    glBindVertexArray(vertex_array);
+
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0,
+                          sizeof(screen_quad) / sizeof(GLfloat) / 2,
+                          count);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    glDisable(GL_STENCIL_TEST);
+}
+
 bool RenderImpl::RenderText(text::TextBufferPtr text_buf) {
 	glEnable (GL_BLEND);
 
+    //the stencil pass commits the layout, the backgrounds are drawn
+    //between it and the cover pass without stencil test
+    if (m_Mode == RENDER_MODE_STENCIL) {
+        DrawStencil(&text_buf, 1);
+
+        auto & state = GetBufferState(text_buf);
+
+        UpdateBufferState(text_buf, state);
+
+        DrawBackground(state.background_vertex_array, text_buf->GetBackgroundAttrCount());
+        DrawCover(state.vertex_array, text_buf->GetTextAttrCount());
+        text_buf->ClearGlyphStencil(m_Transform);
+        return true;
+    }
+
 	text_buf->GenTexture();
 
-    InitVertexArray(text_buf);
+    auto & state = GetBufferState(text_buf);
+
+    UpdateBufferState(text_buf, state);
+
+	DrawBackground(state.background_vertex_array, text_buf->GetBackgroundAttrCount());
+
+    //a single buffer has one texture rect for all rects
+    glVertexAttrib4fv(4, text_buf->GetTextureRect());
+
+	DrawForeground(state.vertex_array, text_buf->GetTexture(),
+                   text_buf->GetAntialias(), text_buf->GetTextAttrCount());
+
+    return true;
+}
+
+bool RenderImpl::RenderTexts(const text::TextBufferPtr * text_bufs, size_t count) {
+	glEnable (GL_BLEND);
+
+    if (m_Mode == RENDER_MODE_STENCIL) {
+        DrawStencil(text_bufs, count);
+
+        if (BatchChanged(text_bufs, count))
+            UpdateBatch(text_bufs, count);
+
+        DrawBackground(m_Batch.background_vertex_array, m_Batch.back_attrs.size());
+
+        //no textures, so the rects of all buffers fill in one draw
+        InitBatchAttribPointers(0);
+        DrawCover(m_Batch.vertex_array, m_Batch.fore_attrs.size());
+
+        for(size_t i = 0; i < count; i++)
+            text_bufs[i]->ClearGlyphStencil(m_Transform);
 
-	DrawBackground(text_buf);
+        return true;
+    }
+
+    for(size_t i = 0; i < count; i++)
+        text_bufs[i]->GenTexture();
+
+    if (BatchChanged(text_bufs, count))
+        UpdateBatch(text_bufs, count);
 
-	DrawForeground(text_buf);
+    DrawBackground(m_Batch.background_vertex_array, m_Batch.back_attrs.size());
+
+    for(const auto & range : m_Batch.ranges) {
+        InitBatchAttribPointers(range.first);
+        DrawForeground(m_Batch.vertex_array, range.texture, range.antialias, range.count);
+    }
 
     return true;
 }
 
+void RenderImpl::SetTransform(const float * transform) {
+    static const GLfloat identity[] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+
+    if (!transform) {
+        std::copy(identity, identity + 9, m_Transform);
+        return;
+    }
+
+    //the passes draw in clip space, -1..1 instead of 0..1, so the
+    //translation picks up the linear part applied to the offset
+    std::copy(transform, transform + 9, m_Transform);
+
+    m_Transform[2] = m_Transform[5] = 0;
+    m_Transform[6] = transform[0] + transform[3] + 2 * transform[6] - 1;
+    m_Transform[7] = transform[1] + transform[4] + 2 * transform[7] - 1;
+    m_Transform[8] = 1;
+}
+
+bool RenderImpl::RenderText(text::TextBufferPtr text_buf,
+                            uint32_t target_fbo,
+                            const int32_t * dest_rect,
+                            const float * transform) {
+    GLint old_frame_buffer = 0;
+    GLint old_viewport[4];
+    GLint old_scissor[4];
+    GLboolean old_scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_frame_buffer);
+    glGetIntegerv(GL_VIEWPORT, old_viewport);
+    glGetIntegerv(GL_SCISSOR_BOX, old_scissor);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+
+    if (dest_rect) {
+        glViewport(dest_rect[0], dest_rect[1], dest_rect[2], dest_rect[3]);
+
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(dest_rect[0], dest_rect[1], dest_rect[2], dest_rect[3]);
+    }
+
+    SetTransform(transform);
+
+    bool result = RenderText(text_buf);
+
+    SetTransform(nullptr);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, old_frame_buffer);
+    glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+    glScissor(old_scissor[0], old_scissor[1], old_scissor[2], old_scissor[3]);
+
+    if (!old_scissor_test)
+        glDisable(GL_SCISSOR_TEST);
+
+    return result;
+}
+
 } //namespace impl
 
-RenderPtr CreateRender() {
-    return std::make_shared<impl::RenderImpl>();
+RenderPtr CreateRender(render_mode_e mode) {
+    return std::make_shared<impl::RenderImpl>(mode);
 }
 
 } //namespace render
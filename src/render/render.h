@@ -5,6 +5,15 @@
 namespace ftdgl {
 namespace render {
 
+enum render_mode_e {
+    //glyphs accumulate in a texture per buffer, composited antialiased
+    RENDER_MODE_TEXTURE = 0,
+    //glyphs write the stencil of the target, then the text rects are
+    //filled where it is set, no texture but aliased unless the target
+    //is multisampled, the target needs a stencil buffer
+    RENDER_MODE_STENCIL,
+};
+
 class Render {
 public:
     Render() = default;
@@ -12,11 +21,25 @@ public:
 
 public:
     virtual bool RenderText(text::TextBufferPtr text_buf) = 0;
+    //render into target_fbo instead of the bound frame buffer, the buffer
+    //viewport is mapped to dest_rect, x, y, width, height in frame buffer
+    //pixels, and drawing is scissored to it, transform is a column major
+    //3x3 affine matrix applied to viewport coordinates in 0..1 first, null
+    //dest_rect or transform keep the bound viewport or add no transform,
+    //the frame buffer, viewport and scissor bound before are restored
+    virtual bool RenderText(text::TextBufferPtr text_buf,
+                            uint32_t target_fbo,
+                            const int32_t * dest_rect,
+                            const float * transform) = 0;
+    //render count buffers with one draw per pass and texture, buffers
+    //sharing a RenderTargetPool page share the draws, all backgrounds
+    //are drawn before the text of any buffer
+    virtual bool RenderTexts(const text::TextBufferPtr * text_bufs, size_t count) = 0;
 };
 
 using RenderPtr = std::shared_ptr<Render>;
 
-RenderPtr CreateRender();
+RenderPtr CreateRender(render_mode_e mode = RENDER_MODE_TEXTURE);
 
 } //namespace render
 } //namespace ftdgl
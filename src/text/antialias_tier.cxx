@@ -0,0 +1,106 @@
+#include "opengl.h"
+
+#include "antialias_tier.h"
+
+namespace ftdgl {
+namespace text {
+namespace impl {
+/*
+  # 6x subpixel AA pattern
+  #
+  #   R = (f(x - 2/3, y) + f(x - 1/3, y) + f(x, y)) / 3
+  #   G = (f(x - 1/3, y) + f(x, y) + f(x + 1/3, y)) / 3
+  #   B = (f(x, y) + f(x + 1/3, y) + f(x + 2/3, y)) / 3
+  #
+  # The shader would require three texture lookups if the texture format
+  # stored data for offsets -1/3, 0, and +1/3 since the shader also needs
+  # data for offsets -2/3 and +2/3. To avoid this, the texture format stores
+  # data for offsets 0, +1/3, and +2/3 instead. That way the shader can get
+  # data for offsets -2/3 and -1/3 with only one additional texture lookup.
+  #
+*/
+static
+const
+glm::vec2 JITTER_PATTERN[] = {
+    {-1 / 12.0, -5 / 12.0},
+	{ 1 / 12.0,  1 / 12.0},
+	{ 3 / 12.0, -1 / 12.0},
+	{ 5 / 12.0,  5 / 12.0},
+	{ 7 / 12.0, -3 / 12.0},
+	{ 9 / 12.0,  3 / 12.0},
+};
+
+//channel of the accumulation texture each jitter sample counts into,
+//upper 4 bits front faces, lower 4 bits back faces
+static
+const
+glm::vec4 JITTER_FRONT[] = {
+    {16, 0, 0, 0},
+    {16, 0, 0, 0},
+    {0, 16, 0, 0},
+    {0, 16, 0, 0},
+    {0, 0, 16, 0},
+    {0, 0, 16, 0},
+};
+
+static
+const
+glm::vec4 JITTER_BACK[] = {
+    {1, 0, 0, 0},
+    {1, 0, 0, 0},
+    {0, 1, 0, 0},
+    {0, 1, 0, 0},
+    {0, 0, 1, 0},
+    {0, 0, 1, 0},
+};
+
+//rotated grid around the center of the lcd pattern, so text does not
+//move between tiers
+static
+const
+glm::vec2 GRAY_4X_PATTERN[] = {
+    {-0.5 / 12.0, -1.5 / 12.0},
+    { 2.5 / 12.0, -4.5 / 12.0},
+    { 5.5 / 12.0,  4.5 / 12.0},
+    { 8.5 / 12.0,  1.5 / 12.0},
+};
+
+static
+const
+glm::vec2 GRAY_1X_PATTERN[] = {
+    {4 / 12.0, 0},
+};
+
+//gray tiers count all samples into full 8 bit counters, front faces in
+//red and back faces in green, a packed channel would overflow after 3
+//overlapping triangles of the 4x tier
+static
+const
+glm::vec4 GRAY_FRONT[] = {
+    {1, 0, 0, 0},
+    {1, 0, 0, 0},
+    {1, 0, 0, 0},
+    {1, 0, 0, 0},
+};
+
+static
+const
+glm::vec4 GRAY_BACK[] = {
+    {0, 1, 0, 0},
+    {0, 1, 0, 0},
+    {0, 1, 0, 0},
+    {0, 1, 0, 0},
+};
+
+} //namespace impl
+
+const antialias_tier_s ANTIALIAS_TIERS[] = {
+    {impl::JITTER_PATTERN, impl::JITTER_FRONT, impl::JITTER_BACK, sizeof(impl::JITTER_PATTERN) / sizeof(glm::vec2), GL_RGB},
+    {impl::GRAY_4X_PATTERN, impl::GRAY_FRONT, impl::GRAY_BACK, sizeof(impl::GRAY_4X_PATTERN) / sizeof(glm::vec2), GL_RG8},
+    {impl::GRAY_1X_PATTERN, impl::GRAY_FRONT, impl::GRAY_BACK, sizeof(impl::GRAY_1X_PATTERN) / sizeof(glm::vec2), GL_RG8},
+};
+
+const int ANTIALIAS_TIER_COUNT = sizeof(ANTIALIAS_TIERS) / sizeof(antialias_tier_s);
+
+} //namespace text
+} //namespace ftdgl
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+namespace ftdgl {
+namespace text {
+
+//jitter samples of an antialias tier, front and back are the counts a
+//front or a back face of a sample adds to the accumulation channels, the
+//lcd tier packs 4 bit front and back counters into one channel per
+//sample, gray tiers count front faces in red and back faces in green
+typedef struct __antialias_tier_s {
+    const glm::vec2 * jitter;
+    const glm::vec4 * front;
+    const glm::vec4 * back;
+    uint32_t samples;
+    //GL internal format of the accumulation texture
+    uint32_t format;
+} antialias_tier_s;
+
+//indexed by viewport::antialias_e
+extern const antialias_tier_s ANTIALIAS_TIERS[];
+extern const int ANTIALIAS_TIER_COUNT;
+
+} //namespace text
+} //namespace ftdgl
@@ -0,0 +1,232 @@
+#include "compute_rasterizer.h"
+#include "program.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+namespace ftdgl {
+namespace text {
+#ifdef GL_COMPUTE_SHADER
+namespace impl {
+
+//a tile is one work group, one invocation per pixel
+constexpr GLint TILE_SIZE = 16;
+
+//an instance overlapping a tile, matches entry_s of the compute shader
+typedef struct __tile_entry_s {
+    GLint first_vertex;
+    GLsizei vertex_count;
+    float x;
+    float y;
+} tile_entry_s;
+
+//first entry and entry count of a tile
+typedef struct __tile_s {
+    uint32_t first;
+    uint32_t count;
+} tile_s;
+
+typedef struct __raster_program_s {
+    ProgramPtr program;
+    GLint target_origin_index;
+    GLint target_size_index;
+    GLint tile_columns_index;
+    GLint jitter_index;
+    GLint front_index;
+    GLint back_index;
+} raster_program_s;
+
+class ComputeRasterizerImpl : public ComputeRasterizer {
+public:
+    ComputeRasterizerImpl()
+        : m_Programs {}
+        , m_Tiles {}
+        , m_Entries {} {
+        glGenBuffers(1, &m_TileBuffer);
+        glGenBuffers(1, &m_EntryBuffer);
+    }
+
+    virtual ~ComputeRasterizerImpl() {
+        glDeleteBuffers(1, &m_TileBuffer);
+        glDeleteBuffers(1, &m_EntryBuffer);
+    }
+
+public:
+    virtual bool Raster(const raster_target_s & target,
+                        GLuint geometry_buffer,
+                        const glyph_range_s * ranges, size_t range_count,
+                        const glyph_instance_s * instances,
+                        GLuint samples, const float * jitter,
+                        const float * front, const float * back);
+
+private:
+    const raster_program_s & GetProgram(GLuint samples, bool gray);
+    void BinInstances(const raster_target_s & target,
+                      const glyph_range_s * ranges, size_t range_count,
+                      const glyph_instance_s * instances,
+                      GLint columns, GLint rows);
+
+    //index is samples * 2 + gray
+    std::vector<raster_program_s> m_Programs;
+    std::vector<tile_s> m_Tiles;
+    std::vector<tile_entry_s> m_Entries;
+    GLuint m_TileBuffer;
+    GLuint m_EntryBuffer;
+};
+
+const raster_program_s & ComputeRasterizerImpl::GetProgram(GLuint samples, bool gray) {
+    size_t index = samples * 2 + (gray ? 1 : 0);
+
+    if (index >= m_Programs.size())
+        m_Programs.resize(index + 1);
+
+    auto & program = m_Programs[index];
+
+    if (program.program)
+        return program;
+
+    program.program = CreateComputeRasterProgram(samples, gray);
+    program.target_origin_index = glGetUniformLocation(*program.program, "target_origin");
+    program.target_size_index = glGetUniformLocation(*program.program, "target_size");
+    program.tile_columns_index = glGetUniformLocation(*program.program, "tile_columns");
+    program.jitter_index = glGetUniformLocation(*program.program, "jitter");
+    program.front_index = glGetUniformLocation(*program.program, "front");
+    program.back_index = glGetUniformLocation(*program.program, "back");
+
+    return program;
+}
+
+void ComputeRasterizerImpl::BinInstances(const raster_target_s & target,
+                                         const glyph_range_s * ranges, size_t range_count,
+                                         const glyph_instance_s * instances,
+                                         GLint columns, GLint rows) {
+    m_Tiles.assign(columns * rows, {0, 0});
+
+    //tiles an instance overlaps, one more pixel around covers the jitter
+    auto for_each_tile = [&](const glyph_range_s & range, const glyph_instance_s & instance,
+                             auto && fn) {
+        float x = instance.x - target.origin_x;
+        float y = instance.y - target.origin_y;
+
+        GLint column0 = std::max<GLint>(0, floor((x + range.bounds[0] - 1) / TILE_SIZE));
+        GLint row0 = std::max<GLint>(0, floor((y + range.bounds[1] - 1) / TILE_SIZE));
+        GLint column1 = std::min<GLint>(columns - 1, floor((x + range.bounds[2] + 1) / TILE_SIZE));
+        GLint row1 = std::min<GLint>(rows - 1, floor((y + range.bounds[3] + 1) / TILE_SIZE));
+
+        for(GLint row = row0; row <= row1; row++) {
+            for(GLint column = column0; column <= column1; column++)
+                fn(m_Tiles[row * columns + column], x, y);
+        }
+    };
+
+    //count, then place the entries of each tile next to each other
+    for(size_t r = 0; r < range_count; r++) {
+        for(uint32_t i = 0; i < ranges[r].count; i++) {
+            for_each_tile(ranges[r], instances[ranges[r].first + i],
+                          [](tile_s & tile, float, float) {
+                              tile.count++;
+                          });
+        }
+    }
+
+    uint32_t first = 0;
+
+    for(auto & tile : m_Tiles) {
+        tile.first = first;
+        first += tile.count;
+        tile.count = 0;
+    }
+
+    m_Entries.resize(first);
+
+    for(size_t r = 0; r < range_count; r++) {
+        const auto & range = ranges[r];
+
+        for(uint32_t i = 0; i < range.count; i++) {
+            for_each_tile(range, instances[range.first + i],
+                          [this, &range](tile_s & tile, float x, float y) {
+                              m_Entries[tile.first + tile.count++] =
+                                      {range.first_vertex, range.vertex_count, x, y};
+                          });
+        }
+    }
+}
+
+bool ComputeRasterizerImpl::Raster(const raster_target_s & target,
+                                   GLuint geometry_buffer,
+                                   const glyph_range_s * ranges, size_t range_count,
+                                   const glyph_instance_s * instances,
+                                   GLuint samples, const float * jitter,
+                                   const float * front, const float * back) {
+    if (!target.width || !target.height)
+        return false;
+
+    GLint columns = (target.width + TILE_SIZE - 1) / TILE_SIZE;
+    GLint rows = (target.height + TILE_SIZE - 1) / TILE_SIZE;
+
+    BinInstances(target, ranges, range_count, instances, columns, rows);
+
+    //an empty storage buffer can not be bound
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_TileBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_Tiles.size() * sizeof(tile_s),
+                 m_Tiles.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_EntryBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 std::max<size_t>(1, m_Entries.size()) * sizeof(tile_entry_s),
+                 m_Entries.empty() ? nullptr : m_Entries.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    bool gray = target.format == GL_RG8;
+    const auto & program = GetProgram(samples, gray);
+
+    glUseProgram(*program.program);
+
+    glUniform2i(program.target_origin_index, target.x, target.y);
+    glUniform2i(program.target_size_index, target.width, target.height);
+    glUniform1i(program.tile_columns_index, columns);
+    glUniform2fv(program.jitter_index, samples, jitter);
+    glUniform4fv(program.front_index, samples, front);
+    glUniform4fv(program.back_index, samples, back);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, geometry_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_EntryBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_TileBuffer);
+    glBindImageTexture(0, target.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, target.format);
+
+    glDispatchCompute(columns, rows, 1);
+
+    //the composite samples the texture next
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, target.format);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+    glUseProgram(0);
+
+    return true;
+}
+
+} //namespace impl
+#endif
+
+ComputeRasterizerPtr CreateComputeRasterizer() {
+#ifndef GL_COMPUTE_SHADER
+    //headers without compute shaders, as on macOS
+    return {};
+#else
+    GLint major = 0, minor = 0;
+
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+    if (major < 4 || (major == 4 && minor < 3))
+        return {};
+
+    return std::make_shared<impl::ComputeRasterizerImpl>();
+#endif
+}
+
+} //namespace text
+} //namespace ftdgl
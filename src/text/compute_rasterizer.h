@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <cstdint>
+
+#include "opengl.h"
+#include "text_layout.h"
+
+namespace ftdgl {
+namespace text {
+
+//instances of one glyph after sorting, ready for one instanced draw
+typedef struct __glyph_range_s {
+    uint32_t key;
+    uint32_t first;
+    uint32_t count;
+    GLint first_vertex;
+    GLsizei vertex_count;
+    //bounds of the glyph geometry around its origin, x0, y0, x1, y1
+    float bounds[4];
+} glyph_range_s;
+
+//the part of a texture the coverage is written to, x and y is its lower
+//left corner in the texture, origin_x and origin_y the viewport pixel
+//that corner shows
+typedef struct __raster_target_s {
+    GLuint texture;
+    GLenum format;
+    GLint x;
+    GLint y;
+    GLsizei width;
+    GLsizei height;
+    GLint origin_x;
+    GLint origin_y;
+} raster_target_s;
+
+//writes the packed front and back face counts of the accumulation pass
+//with a compute shader instead of drawing every glyph once per sample,
+//instances are binned into screen tiles on the cpu, call on the GL thread
+class ComputeRasterizer {
+public:
+    ComputeRasterizer() = default;
+    virtual ~ComputeRasterizer() = default;
+
+public:
+    //geometry_buffer holds the vertices the ranges point at, jitter has
+    //samples entries of 2 floats, front and back of 4 as antialias_tier_s
+    virtual bool Raster(const raster_target_s & target,
+                        GLuint geometry_buffer,
+                        const glyph_range_s * ranges, size_t range_count,
+                        const glyph_instance_s * instances,
+                        GLuint samples, const float * jitter,
+                        const float * front, const float * back) = 0;
+};
+
+using ComputeRasterizerPtr = std::shared_ptr<ComputeRasterizer>;
+
+//empty without GL 4.3
+ComputeRasterizerPtr CreateComputeRasterizer();
+
+} //namespace text
+} //namespace ftdgl
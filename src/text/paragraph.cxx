@@ -0,0 +1,261 @@
+#include "paragraph.h"
+#include "char_width.h"
+
+#include <iostream>
+#include <vector>
+
+namespace ftdgl {
+namespace text {
+namespace impl {
+
+//break opportunities are only before a word, a word keeps its trailing
+//spaces, which do not count when it is the last word of a line
+typedef struct __word_s {
+    size_t begin;
+    size_t length;
+    size_t space_length;
+    uint32_t style;
+    double width;
+    double space_width;
+    bool break_before;
+    bool new_line;
+} word_s;
+
+using word_vector = std::vector<word_s>;
+using markup_vector = std::vector<markup_s>;
+
+static
+const wchar_t NEW_LINE[] = L"\n";
+
+class ParagraphImpl : public Paragraph {
+public:
+    ParagraphImpl(const viewport::viewport_s & viewport)
+        : m_Viewport {viewport}
+        , m_Text {}
+        , m_Words {}
+        , m_Markups {}
+        , m_LineStarts {}
+        , m_StyleIds {}
+        , m_Runs {}
+        , m_BreakNext {false} {
+    }
+
+    virtual ~ParagraphImpl() = default;
+
+public:
+    virtual void AddText(const markup_s & markup, const std::wstring & text);
+    virtual void Clear();
+    virtual size_t Layout(double width);
+    virtual size_t GetLineCount() const { return m_LineStarts.size(); }
+    virtual bool AddToBuffer(TextBufferPtr buffer, pen_s & pen) {
+        return AddTo(*buffer, pen);
+    }
+
+    virtual bool AddToLayout(TextLayoutPtr layout, pen_s & pen) {
+        return AddTo(*layout, pen);
+    }
+
+private:
+    uint32_t GetStyle(const markup_s & markup);
+    void StartWord(uint32_t style, bool break_before, bool new_line);
+    double GetAdvance(const markup_s & markup, wchar_t ch) const;
+    //TextBuffer or TextLayout, both take styles and runs the same way
+    template<typename T>
+    bool AddTo(T & target, pen_s & pen);
+
+    const viewport::viewport_s & m_Viewport;
+
+    std::wstring m_Text;
+    word_vector m_Words;
+    markup_vector m_Markups;
+    //index of the first word of each line
+    std::vector<size_t> m_LineStarts;
+
+    std::vector<uint32_t> m_StyleIds;
+    std::vector<text_run_s> m_Runs;
+
+    //a break is allowed before the next non space char
+    bool m_BreakNext;
+};
+
+static
+bool is_same_color(const color_s & a, const color_s & b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+uint32_t ParagraphImpl::GetStyle(const markup_s & markup) {
+    for(size_t i = 0; i < m_Markups.size(); i++) {
+        const auto & m = m_Markups[i];
+
+        if (m.font == markup.font
+            && is_same_color(m.fore_color, markup.fore_color)
+            && is_same_color(m.back_color, markup.back_color))
+            return i;
+    }
+
+    m_Markups.push_back(markup);
+    return m_Markups.size() - 1;
+}
+
+void ParagraphImpl::StartWord(uint32_t style, bool break_before, bool new_line) {
+    m_Words.push_back({m_Text.size(), 0, 0, style, 0, 0, break_before, new_line});
+}
+
+//same advance TextBuffer uses when laying the char out, measured
+//without loading the glyph outline
+double ParagraphImpl::GetAdvance(const markup_s & markup, wchar_t ch) const {
+    if (m_Viewport.glyph_width)
+        return char_width(ch) > 1 ? m_Viewport.glyph_width * 2 : m_Viewport.glyph_width;
+
+    return markup.font->GetAdvance(ch);
+}
+
+void ParagraphImpl::AddText(const markup_s & markup, const std::wstring & text) {
+    uint32_t style = GetStyle(markup);
+
+    for(auto ch : text) {
+        if (ch == L'\n') {
+            StartWord(style, true, true);
+            m_BreakNext = false;
+            continue;
+        }
+
+        if (m_Words.empty()) {
+            StartWord(style, false, false);
+        } else if (m_Words.back().style != style) {
+            if (m_Words.back().length)
+                StartWord(style, m_BreakNext, false);
+            else
+                m_Words.back().style = style;
+        }
+
+        double adv = GetAdvance(markup, ch);
+        bool wide = char_width(ch) > 1;
+
+        if (ch == L' ' || ch == L'\t') {
+            auto & w = m_Words.back();
+
+            w.length++;
+            w.space_length++;
+            w.space_width += adv;
+            m_BreakNext = true;
+        } else {
+            if (m_Words.back().length && (m_BreakNext || wide))
+                StartWord(style, true, false);
+
+            auto & w = m_Words.back();
+
+            w.length++;
+            w.width += adv;
+            m_BreakNext = wide;
+        }
+
+        m_Text.push_back(ch);
+    }
+}
+
+void ParagraphImpl::Clear() {
+    m_Text.clear();
+    m_Words.clear();
+    m_Markups.clear();
+    m_LineStarts.clear();
+    m_BreakNext = false;
+}
+
+size_t ParagraphImpl::Layout(double width) {
+    m_LineStarts.clear();
+
+    if (m_Words.empty())
+        return 0;
+
+    m_LineStarts.push_back(0);
+
+    double x = 0;
+    size_t count = m_Words.size();
+
+    for(size_t i = 0; i < count;) {
+        //text starting with a line break starts with an empty line
+        if (m_Words[i].new_line) {
+            m_LineStarts.push_back(i);
+            x = 0;
+        }
+
+        //words without a break opportunity between them stay together
+        double ink = m_Words[i].width;
+        double full = ink + m_Words[i].space_width;
+        size_t j = i + 1;
+
+        for(; j < count && !m_Words[j].break_before && !m_Words[j].new_line; j++) {
+            ink = full + m_Words[j].width;
+            full = ink + m_Words[j].space_width;
+        }
+
+        if (x > 0 && x + ink > width) {
+            m_LineStarts.push_back(i);
+            x = 0;
+        }
+
+        x += full;
+        i = j;
+    }
+
+    return m_LineStarts.size();
+}
+
+template<typename T>
+bool ParagraphImpl::AddTo(T & target, pen_s & pen) {
+    m_StyleIds.resize(m_Markups.size());
+
+    for(size_t i = 0; i < m_Markups.size(); i++)
+        m_StyleIds[i] = target.AddStyle(m_Markups[i]);
+
+    m_Runs.clear();
+
+    for(size_t line = 0; line < m_LineStarts.size(); line++) {
+        size_t first = m_LineStarts[line];
+        size_t last = line + 1 < m_LineStarts.size() ? m_LineStarts[line + 1] : m_Words.size();
+        bool wrapped = last < m_Words.size() && !m_Words[last].new_line;
+        //the line break moves down by the tallest style on the line
+        uint32_t tallest = m_Words[first].style;
+
+        for(size_t i = first; i < last; i++) {
+            const auto & w = m_Words[i];
+            size_t length = w.length;
+
+            if (m_Markups[w.style].font->GetHeight() > m_Markups[tallest].font->GetHeight())
+                tallest = w.style;
+
+            if (wrapped && i + 1 == last)
+                length -= w.space_length;
+
+            if (!length)
+                continue;
+
+            auto style_id = m_StyleIds[w.style];
+
+            //merge with the previous run when the text continues it
+            if (!m_Runs.empty()
+                && m_Runs.back().style_id == style_id
+                && m_Runs.back().text + m_Runs.back().length == m_Text.c_str() + w.begin) {
+                m_Runs.back().length += length;
+                continue;
+            }
+
+            m_Runs.push_back({style_id, m_Text.c_str() + w.begin, length});
+        }
+
+        if (last < m_Words.size())
+            m_Runs.push_back({m_StyleIds[tallest], NEW_LINE, 1});
+    }
+
+    return target.AddRuns(pen, m_Runs.data(), m_Runs.size());
+}
+
+} //namespace impl
+
+ParagraphPtr CreateParagraph(const viewport::viewport_s & viewport) {
+    return std::make_shared<impl::ParagraphImpl>(viewport);
+}
+
+} //namespace text
+} //namespace ftdgl
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "pen.h"
+#include "markup.h"
+#include "viewport.h"
+#include "text_layout.h"
+#include "text_buffer.h"
+
+namespace ftdgl {
+namespace text {
+
+//styled text broken into lines to fit a width, words are measured once
+//in AddText so a width change only reruns the line fitting in Layout
+class Paragraph {
+public:
+    Paragraph() = default;
+    virtual ~Paragraph() = default;
+
+public:
+    virtual void AddText(const markup_s & markup, const std::wstring & text) = 0;
+    virtual void Clear() = 0;
+    //break the text into lines no wider than width, return the line count,
+    //a word wider than width gets a line of its own
+    virtual size_t Layout(double width) = 0;
+    virtual size_t GetLineCount() const = 0;
+    //add the lines of the last Layout to the buffer starting at pen
+    virtual bool AddToBuffer(TextBufferPtr buffer, pen_s & pen) = 0;
+    virtual bool AddToLayout(TextLayoutPtr layout, pen_s & pen) = 0;
+};
+
+using ParagraphPtr = std::shared_ptr<Paragraph>;
+
+ParagraphPtr CreateParagraph(const viewport::viewport_s & viewport);
+
+} //namespace text
+} //namespace ftdgl
@@ -0,0 +1,327 @@
+#include "opengl.h"
+
+#include "render_target_pool.h"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+namespace ftdgl {
+namespace text {
+namespace impl {
+
+//lease sizes are rounded up to this, so freed rects fit the next lease
+constexpr uint32_t LEASE_SIZE_STEP = 16;
+
+typedef struct __free_span_s {
+    uint32_t x;
+    uint32_t width;
+} free_span_s;
+
+//a row of the page holding leases of about the same height, free spans
+//are sorted by x and never adjacent
+typedef struct __shelf_s {
+    uint32_t y;
+    uint32_t height;
+    std::vector<free_span_s> free;
+} shelf_s;
+
+typedef struct __page_s {
+    GLuint texture;
+    GLuint frame_buffer;
+    GLenum format;
+    uint32_t width;
+    uint32_t height;
+    //y where the next shelf starts
+    uint32_t top;
+    uint32_t lease_count;
+    uint64_t used_area;
+    std::vector<shelf_s> shelves;
+} page_s;
+
+using page_ptr = std::unique_ptr<page_s>;
+
+class RenderTargetPoolImpl : public RenderTargetPool {
+public:
+    RenderTargetPoolImpl(uint32_t page_width, uint32_t page_height)
+        : m_PageWidth {page_width}
+        , m_PageHeight {page_height}
+        , m_Pages {} {
+    }
+
+    virtual ~RenderTargetPoolImpl() {
+        for(auto & page : m_Pages) {
+            if (page)
+                DestroyPage(*page);
+        }
+    }
+
+public:
+    virtual bool Acquire(uint32_t width, uint32_t height, uint32_t format, target_lease_s & lease);
+    virtual void Release(const target_lease_s & lease);
+    virtual void GetStats(target_pool_stats_s & stats) const;
+
+private:
+    bool CreatePage(uint32_t width, uint32_t height, GLenum format, uint32_t & index);
+    void DestroyPage(page_s & page);
+    bool AllocInShelf(shelf_s & shelf, uint32_t width, uint32_t & x);
+    void MakeLease(uint32_t page, uint32_t shelf, uint32_t x,
+                   uint32_t width, uint32_t height, target_lease_s & lease);
+
+    uint32_t m_PageWidth;
+    uint32_t m_PageHeight;
+    //destroyed pages leave a null slot so page indices stay valid
+    std::vector<page_ptr> m_Pages;
+};
+
+static
+uint32_t round_up(uint32_t v) {
+    return (v + LEASE_SIZE_STEP - 1) / LEASE_SIZE_STEP * LEASE_SIZE_STEP;
+}
+
+bool RenderTargetPoolImpl::CreatePage(uint32_t width, uint32_t height, GLenum format, uint32_t & index) {
+    page_ptr page {new page_s {0, 0, format, width, height, 0, 0, 0, {}}};
+
+	glGenTextures(1, &page->texture);
+	glBindTexture(GL_TEXTURE_2D, page->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0,format, width, height, 0,GL_RGB, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint old_frame_buffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_frame_buffer);
+
+	glGenFramebuffers(1, &page->frame_buffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, page->frame_buffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, page->texture, 0);
+
+	GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
+	glDrawBuffers(1, DrawBuffers);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, old_frame_buffer);
+
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "frame buffer status error:" << status << std::endl;
+		DestroyPage(*page);
+		return false;
+	}
+
+    for(index = 0; index < m_Pages.size(); index++) {
+        if (!m_Pages[index])
+            break;
+    }
+
+    if (index == m_Pages.size())
+        m_Pages.emplace_back();
+
+    m_Pages[index] = std::move(page);
+    return true;
+}
+
+void RenderTargetPoolImpl::DestroyPage(page_s & page) {
+    glDeleteFramebuffers(1, &page.frame_buffer);
+    glDeleteTextures(1, &page.texture);
+}
+
+bool RenderTargetPoolImpl::AllocInShelf(shelf_s & shelf, uint32_t width, uint32_t & x) {
+    for(size_t i = 0; i < shelf.free.size(); i++) {
+        auto & span = shelf.free[i];
+
+        if (span.width < width)
+            continue;
+
+        x = span.x;
+        span.x += width;
+        span.width -= width;
+
+        if (!span.width)
+            shelf.free.erase(shelf.free.begin() + i);
+
+        return true;
+    }
+
+    return false;
+}
+
+void RenderTargetPoolImpl::MakeLease(uint32_t page_index, uint32_t shelf_index, uint32_t x,
+                                     uint32_t width, uint32_t height, target_lease_s & lease) {
+    auto & page = *m_Pages[page_index];
+
+    page.lease_count++;
+    page.used_area += (uint64_t)width * height;
+
+    lease.page = page_index;
+    lease.shelf = shelf_index;
+    lease.frame_buffer = page.frame_buffer;
+    lease.texture = page.texture;
+    lease.x = x;
+    lease.y = page.shelves[shelf_index].y;
+    lease.width = width;
+    lease.height = height;
+    lease.texture_width = page.width;
+    lease.texture_height = page.height;
+}
+
+bool RenderTargetPoolImpl::Acquire(uint32_t width, uint32_t height, uint32_t format, target_lease_s & lease) {
+    if (!width || !height)
+        return false;
+
+    width = round_up(width);
+    height = round_up(height);
+
+    uint32_t x = 0;
+
+    //reuse a shelf that wastes at most half the lease height
+    for(uint32_t p = 0; p < m_Pages.size(); p++) {
+        if (!m_Pages[p])
+            continue;
+
+        auto & page = *m_Pages[p];
+
+        if (page.format != format)
+            continue;
+
+        for(uint32_t s = 0; s < page.shelves.size(); s++) {
+            auto & shelf = page.shelves[s];
+
+            if (shelf.height < height || shelf.height > height + height / 2)
+                continue;
+
+            if (AllocInShelf(shelf, width, x)) {
+                MakeLease(p, s, x, width, height, lease);
+                return true;
+            }
+        }
+    }
+
+    //open a new shelf on top of a page
+    for(uint32_t p = 0; p < m_Pages.size(); p++) {
+        if (!m_Pages[p])
+            continue;
+
+        auto & page = *m_Pages[p];
+
+        if (page.format != format || page.width < width || page.height - page.top < height)
+            continue;
+
+        page.shelves.push_back({page.top, height, {{0, page.width}}});
+        page.top += height;
+
+        AllocInShelf(page.shelves.back(), width, x);
+        MakeLease(p, page.shelves.size() - 1, x, width, height, lease);
+        return true;
+    }
+
+    uint32_t p = 0;
+
+    if (!CreatePage(std::max(m_PageWidth, width), std::max(m_PageHeight, height), format, p))
+        return false;
+
+    auto & page = *m_Pages[p];
+
+    page.shelves.push_back({0, height, {{0, page.width}}});
+    page.top = height;
+
+    AllocInShelf(page.shelves.back(), width, x);
+    MakeLease(p, 0, x, width, height, lease);
+    return true;
+}
+
+void RenderTargetPoolImpl::Release(const target_lease_s & lease) {
+    if (lease.page >= m_Pages.size() || !m_Pages[lease.page])
+        return;
+
+    auto & page = *m_Pages[lease.page];
+
+    if (lease.shelf >= page.shelves.size())
+        return;
+
+    auto & shelf = page.shelves[lease.shelf];
+    auto & spans = shelf.free;
+
+    //put the span back in x order and merge it with its neighbours
+    auto it = std::lower_bound(spans.begin(), spans.end(), (uint32_t)lease.x,
+                               [](const free_span_s & span, uint32_t x) {
+                                   return span.x < x;
+                               });
+
+    it = spans.insert(it, {(uint32_t)lease.x, lease.width});
+
+    if (it + 1 != spans.end() && it->x + it->width == (it + 1)->x) {
+        it->width += (it + 1)->width;
+        spans.erase(it + 1);
+    }
+
+    if (it != spans.begin() && (it - 1)->x + (it - 1)->width == it->x) {
+        (it - 1)->width += it->width;
+        spans.erase(it);
+    }
+
+    page.lease_count--;
+    page.used_area -= (uint64_t)lease.width * lease.height;
+
+    //empty shelves at the top go back to the page
+    while(!page.shelves.empty()) {
+        const auto & top = page.shelves.back();
+
+        if (top.free.size() != 1 || top.free[0].width != page.width)
+            break;
+
+        page.top = top.y;
+        page.shelves.pop_back();
+    }
+
+    if (page.lease_count)
+        return;
+
+    //keep one empty page around for the next lease
+    for(uint32_t p = 0; p < m_Pages.size(); p++) {
+        if (p != lease.page && m_Pages[p] && !m_Pages[p]->lease_count) {
+            DestroyPage(page);
+            m_Pages[lease.page].reset();
+            return;
+        }
+    }
+}
+
+void RenderTargetPoolImpl::GetStats(target_pool_stats_s & stats) const {
+    stats = {0, 0, 0, 0, 0, 0};
+
+    uint64_t shelf_area = 0;
+
+    for(const auto & page : m_Pages) {
+        if (!page)
+            continue;
+
+        stats.page_count++;
+        stats.lease_count += page->lease_count;
+        stats.page_area += (uint64_t)page->width * page->height;
+        stats.used_area += page->used_area;
+
+        for(const auto & shelf : page->shelves)
+            shelf_area += (uint64_t)page->width * shelf.height;
+    }
+
+    uint64_t free_area = stats.page_area - stats.used_area;
+
+    if (stats.page_area)
+        stats.occupancy = (float)stats.used_area / stats.page_area;
+
+    //free spans and height slack inside shelves
+    if (free_area)
+        stats.fragmentation = (float)(shelf_area - stats.used_area) / free_area;
+}
+
+} //namespace impl
+
+RenderTargetPoolPtr CreateRenderTargetPool(uint32_t page_width, uint32_t page_height) {
+    return std::make_shared<impl::RenderTargetPoolImpl>(page_width, page_height);
+}
+
+} //namespace text
+} //namespace ftdgl
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+#include <cstdint>
+
+namespace ftdgl {
+namespace text {
+
+//a sub rect of a pool page, x and y is its lower left corner
+typedef struct __target_lease_s {
+    uint32_t page;
+    uint32_t shelf;
+    uint32_t frame_buffer;
+    uint32_t texture;
+    int32_t x;
+    int32_t y;
+    uint32_t width;
+    uint32_t height;
+    uint32_t texture_width;
+    uint32_t texture_height;
+} target_lease_s;
+
+typedef struct __target_pool_stats_s {
+    uint32_t page_count;
+    uint32_t lease_count;
+    uint64_t page_area;
+    uint64_t used_area;
+    //leased area over page area
+    float occupancy;
+    //free area inside shelves over all free area, high when freed space
+    //only fits leases of about the same height
+    float fragmentation;
+} target_pool_stats_s;
+
+//accumulation textures shared by text buffers, pages are split into
+//shelves of similar height and leased out as sub rects, call on the GL
+//thread only
+class RenderTargetPool {
+public:
+    RenderTargetPool() = default;
+    virtual ~RenderTargetPool() = default;
+
+public:
+    //format is the GL internal format of the texture, pages of
+    //different formats are never shared
+    virtual bool Acquire(uint32_t width, uint32_t height, uint32_t format, target_lease_s & lease) = 0;
+    virtual void Release(const target_lease_s & lease) = 0;
+    virtual void GetStats(target_pool_stats_s & stats) const = 0;
+};
+
+using RenderTargetPoolPtr = std::shared_ptr<RenderTargetPool>;
+
+//larger leases get a page of their own
+RenderTargetPoolPtr CreateRenderTargetPool(uint32_t page_width, uint32_t page_height);
+
+} //namespace text
+} //namespace ftdgl
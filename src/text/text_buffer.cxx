@@ -1,450 +1,1239 @@
 #include "glm/glm.hpp"
-#include "glm/gtc/matrix_transform.hpp"
 #include "shader.h"
 #include "opengl.h"
 
 #include "text_buffer.h"
 #include "program.h"
-#include "char_width.h"
+#include "compute_rasterizer.h"
+#include "antialias_tier.h"
+#include "upload_ring.h"
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
 #include <unordered_map>
-#include <map>
-#include <cassert>
-#include <mutex>
 
 namespace ftdgl {
 namespace text {
 namespace impl {
-/*
-  # 6x subpixel AA pattern
-  #
-  #   R = (f(x - 2/3, y) + f(x - 1/3, y) + f(x, y)) / 3
-  #   G = (f(x - 1/3, y) + f(x, y) + f(x + 1/3, y)) / 3
-  #   B = (f(x, y) + f(x + 1/3, y) + f(x + 2/3, y)) / 3
-  #
-  # The shader would require three texture lookups if the texture format
-  # stored data for offsets -1/3, 0, and +1/3 since the shader also needs
-  # data for offsets -2/3 and +2/3. To avoid this, the texture format stores
-  # data for offsets 0, +1/3, and +2/3 instead. That way the shader can get
-  # data for offsets -2/3 and -1/3 with only one additional texture lookup.
-  #
-*/
+//a text buffer program variant and its uniforms
+typedef struct __glyph_program_s {
+    ProgramPtr program;
+    GLuint viewport_index;
+    GLuint origin_index;
+    GLuint jitter_index;
+    GLuint front_index;
+    GLuint back_index;
+    GLuint transform_index;
+} glyph_program_s;
+
+typedef struct __font_slot_s {
+    FontPtr font;
+    const glyph_table_s * glyphs;
+} font_slot_s;
+
+//column major, for the accumulation and untransformed DrawGlyphs
 static
 const
-glm::vec2 JITTER_PATTERN[] = {
-    {-1 / 12.0, -5 / 12.0},
-	{ 1 / 12.0,  1 / 12.0},
-	{ 3 / 12.0, -1 / 12.0},
-	{ 5 / 12.0,  5 / 12.0},
-	{ 7 / 12.0, -3 / 12.0},
-	{ 9 / 12.0,  3 / 12.0},
+GLfloat IDENTITY_TRANSFORM[] = {
+    1, 0, 0,
+    0, 1, 0,
+    0, 0, 1,
 };
 
-typedef struct __matrix_color_s {
-    glm::mat4 transform;
-    glm::vec4 color;
-} matrix_color_s;
+using glyph_range_vector = std::vector<glyph_range_s>;
+using glyph_instance_vector = std::vector<glyph_instance_s>;
+using font_slot_vector = std::vector<font_slot_s>;
+using text_attr_vector = std::vector<text_attr_s>;
+
+//glyph geometry and glyph instances of one committed layout
+typedef struct __glyph_set_s {
+    glyph_range_vector ranges;
+    font_slot_vector fonts;
+    GLuint geometry_buffer;
+    //glyph keys of the geometry buffer in order, with the fonts it was
+    //filled for, the same glyphs again need no upload
+    std::vector<uint32_t> geometry_keys;
+    font_slot_vector geometry_fonts;
+    //slot geometry is only appended to, first vertex of each glyph in it
+    //by geometry_fonts index and glyph id, with the bytes used and held
+    std::unordered_map<uint32_t, GLint> resident_vertices;
+    size_t geometry_top;
+    size_t geometry_capacity;
+    GLuint instance_buffer;
+    //instances of text committed more than once are written here instead
+    //when persistent mapping is supported, the source is the buffer the
+    //last commit went to
+    util::UploadRingPtr instance_ring;
+    GLuint instance_source;
+    size_t instance_offset;
+    uint32_t upload_count;
+    //x0, y0, x1, y1 in viewport pixels of all glyph outlines, empty when
+    //x0 > x1
+    float ink[4];
+} glyph_set_s;
+
+//a reserved region whose text is replaced on its own, rect is x, y,
+//width, height in viewport pixels
+typedef struct __text_slot_s {
+    GLint rect[4];
+    uint32_t max_glyphs;
+    TextLayoutPtr layout;
+    glyph_set_s glyphs;
+    //clipped to rect
+    text_attr_vector fore_attrs;
+    text_attr_vector back_attrs;
+    bool changed;
+    //the texture still shows the text before the change
+    bool dirty;
+} text_slot_s;
+
+using text_slot_ptr = std::unique_ptr<text_slot_s>;
+using text_slot_vector = std::vector<text_slot_ptr>;
 
-typedef struct __draw_array_indirect_cmd_s{
-    GLuint  count;
-    GLuint  instanceCount;
-    GLuint  first;
-    GLuint  baseInstance;
-} draw_array_indirect_cmd_s;
-
-using matrix_color_vector = std::vector<matrix_color_s>;
-using glyph_matrix_color_map = std::unordered_map<GlyphPtr, matrix_color_vector>;
-using pos_y_matrix_map = std::map<double, matrix_color_vector>;
-using pos_x_matrix_map = std::map<double, pos_y_matrix_map>;
-using font_pos_matrix_map = std::map<float, pos_x_matrix_map>;
-
-static
-const
-glm::mat4 TRANSLATE {glm::translate(glm::mat4(1.0), glm::vec3(-1, -1, 0))};
-
-class TextMatrix {
+class TextBufferImpl : public TextBuffer {
 public:
-    TextMatrix(const viewport::viewport_s & viewport)
+    TextBufferImpl(const viewport::viewport_s & viewport, RenderTargetPoolPtr pool)
         : m_Viewport {viewport}
-        , m_Scale {}
-        , m_Translate3 {}
-        , m_C {}
-        , m_UpdateLock {}
-        , m_FontPosMatrix {} {
+        , m_Pool {pool}
+        , m_Antialias {viewport.antialias >= 0 && viewport.antialias < ANTIALIAS_TIER_COUNT
+                       ? viewport.antialias : viewport::ANTIALIAS_LCD_6X}
+        , m_Tier {ANTIALIAS_TIERS[m_Antialias]}
+        , m_Layout {CreateTextLayout(viewport)}
+        , m_ForeAttribs {}
+        , m_BackAttribs {}
+        , m_Glyphs {}
+        , m_Slots {}
+        , m_Rasterizer {}
+        , m_Instances {} {
         Init();
     }
 
-    virtual ~TextMatrix() = default;
+    virtual ~TextBufferImpl() {
+        Destroy();
+    }
+
+    virtual bool AddText(pen_s & pen, const markup_s & markup, const std::wstring & text) {
+        m_LayoutChanged = true;
+        return m_Layout->AddText(pen, markup, text);
+    }
+
+    virtual uint32_t AddStyle(const markup_s & markup) {
+        return m_Layout->AddStyle(markup);
+    }
+
+    virtual bool AddRuns(pen_s & pen, const text_run_s * runs, size_t count) {
+        m_LayoutChanged = true;
+        return m_Layout->AddRuns(pen, runs, count);
+    }
+
+    virtual void SetLayoutThreads(size_t count) {
+        m_Layout->SetLayoutThreads(count);
+    }
+
+    virtual uint32_t GetTexture() const { return m_RenderedTexture; }
+    virtual const float * GetTextureRect() const { return m_TextureRect; }
+    virtual void Clear();
+    virtual void Commit(TextLayoutPtr layout);
+    virtual uint32_t GetTextAttrCount() const { return m_ForeAttribs.size(); }
+    virtual const text_attr_s * GetTextAttr() const { return m_ForeAttribs.data(); }
+    virtual uint32_t GetBackgroundAttrCount() const { return m_BackAttribs.size(); }
+    virtual const text_attr_s * GetBackgroundAttr() const { return m_BackAttribs.data(); }
+    virtual void GenTexture();
+    virtual void DrawGlyphs(const float * transform);
+    virtual void ClearGlyphStencil(const float * transform);
+    virtual uint64_t GetGeneration() const { return m_Generation; }
+    virtual int GetAntialias() const { return m_Antialias; }
+    virtual bool SetComputeRaster(bool enable);
+    virtual int ReserveSlot(const int32_t * rect, uint32_t max_glyphs);
+    virtual bool SetSlotText(int slot, pen_s & pen, const markup_s & markup, const std::wstring & text);
+
+private:
+    void CommitLayout(TextLayout & layout);
+    void CommitSlots();
+    void MergeSlotAttrs();
+    void UploadGlyphs(glyph_set_s & set, TextLayout & layout, size_t reserve);
+    void UploadResidentGlyphs(glyph_set_s & set, size_t geometry_size);
+    void InitGlyphSet(glyph_set_s & set);
+    void DestroyGlyphSet(glyph_set_s & set);
+    void UpdateTextureRect();
+    void FitTexture();
+    void InitProgram(glyph_program_s & program, GLuint samples);
+    void DrawRegion(const GLint * rect);
+    void DrawGlyphRanges(const glyph_set_s & set, GLuint samples);
+    //window box of rect, x0, y0, x1, y1 in viewport pixels, after transform
+    bool WindowBox(const double * rect, const GLfloat * transform, GLint * box) const;
+    bool ResizeTexture(GLsizei width, GLsizei height);
+    bool LeaseTarget(GLsizei width, GLsizei height);
+    GLenum GetTextureFormat() const;
 
+	GLuint m_RenderedTexture;
+	GLuint m_FrameBuffer;
     const viewport::viewport_s & m_Viewport;
-    glm::mat4 m_Scale;
-    glm::mat4 m_Translate3[sizeof(JITTER_PATTERN) / sizeof(glm::vec2)];
-    glm::vec4 m_C[sizeof(JITTER_PATTERN) / sizeof(glm::vec2)];
-    std::recursive_mutex m_UpdateLock;
-    font_pos_matrix_map m_FontPosMatrix;
-
-    void Init() {
-        //Create transform matrix
-        m_Scale = std::move(TRANSLATE *
-                            glm::scale(glm::mat4(1.0),
-                                       glm::vec3(2.0 / m_Viewport.width,
-                                                 2.0 / m_Viewport.height,
-                                                 0)));
-
-        for(size_t i = 0; i < sizeof(JITTER_PATTERN) / sizeof(glm::vec2); i++) {
-            m_Translate3[i] = std::move(glm::translate(glm::mat4(1.0),
-                                                       glm::vec3(JITTER_PATTERN[i].x / m_Viewport.width,
-                                                                 JITTER_PATTERN[i].y / m_Viewport.height,
-                                                                 0)
-                                                       ));
-            if (i % 2 == 0) {
-                m_C[i] = std::move(glm::vec4(i == 0 ? 1.0 : 0.0,
-                                             i == 2 ? 1.0 : 0.0,
-                                             i == 4 ? 1.0 : 0.0,
-                                             0.0));
-            } else {
-                m_C[i] = m_C[i - 1];
-            }
-        }
+
+    //texture and frame buffer above belong to the pool when set
+    RenderTargetPoolPtr m_Pool;
+    target_lease_s m_Lease;
+    bool m_Leased;
+
+    //viewport antialias when the buffer was created
+    int m_Antialias;
+    const antialias_tier_s & m_Tier;
+
+    glyph_program_s m_Program;
+    //single sample variant for DrawGlyphs, built on first use
+    glyph_program_s m_DirectProgram;
+
+    GLuint m_VertexArray;
+
+    //filled by AddText and AddRuns, committed by GenTexture
+    TextLayoutPtr m_Layout;
+    bool m_LayoutChanged;
+
+    //the rects of the last commit come first, slot rects follow
+    text_attr_vector m_ForeAttribs;
+    text_attr_vector m_BackAttribs;
+    size_t m_StaticForeCount;
+    size_t m_StaticBackCount;
+    //the last commit
+    glyph_set_s m_Glyphs;
+    text_slot_vector m_Slots;
+
+    //GenTexture writes the texture with a compute shader, it needs the
+    //instances on the cpu for binning
+    bool m_ComputeRaster;
+    ComputeRasterizerPtr m_Rasterizer;
+    glyph_instance_vector m_Instances;
+
+    //texture size, the part of it the buffer draws into, viewport pixel
+    //of the lower left corner of that part, the part of it the text
+    //covers and the texture rect in viewport coordinates
+    GLsizei m_TextureWidth;
+    GLsizei m_TextureHeight;
+    GLint m_TargetX;
+    GLint m_TargetY;
+    GLsizei m_TargetWidth;
+    GLsizei m_TargetHeight;
+    GLint m_TextureX;
+    GLint m_TextureY;
+    GLsizei m_UsedWidth;
+    GLsizei m_UsedHeight;
+    float m_TextureRect[4];
+
+    bool m_TextureGenerated;
+    uint64_t m_Generation;
+private:
+    void Init();
+    void Destroy();
+};
+
+void TextBufferImpl::Init() {
+    m_TextureGenerated = false;
+    m_LayoutChanged = false;
+    m_Generation = 0;
+    m_TextureWidth = m_TextureHeight = 0;
+    m_TargetX = m_TargetY = 0;
+    m_TargetWidth = m_TargetHeight = 0;
+    m_TextureX = m_TextureY = 0;
+    m_UsedWidth = m_UsedHeight = 0;
+    m_Leased = false;
+    m_ComputeRaster = false;
+    m_FrameBuffer = m_RenderedTexture = 0;
+    m_StaticForeCount = m_StaticBackCount = 0;
+
+    std::fill(m_TextureRect, m_TextureRect + 4, 0.f);
+
+    //pooled buffers lease their target once the text bounds are known
+    if (!m_Pool) {
+	glGenFramebuffers(1, &m_FrameBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_FrameBuffer);
+
+	// The texture we're going to render to
+	glGenTextures(1, &m_RenderedTexture);
+
+	// "Bind" the newly created texture : all future texture functions will modify this texture
+	glBindTexture(GL_TEXTURE_2D, m_RenderedTexture);
+
+	// Poor filtering
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// Set "renderedTexture" as our colour attachement #0, the image is
+	// given by ResizeTexture once the text bounds are known
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_RenderedTexture, 0);
+
+	// Set the list of draw buffers.
+	GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
+	glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    InitProgram(m_Program, m_Tier.samples);
+
+    glGenVertexArrays(1, &m_VertexArray);
+
+    InitGlyphSet(m_Glyphs);
+}
+
+void TextBufferImpl::Destroy() {
+    if (!m_Pool) {
+        glDeleteFramebuffers(1, &m_FrameBuffer);
+        glDeleteTextures(1, &m_RenderedTexture);
+    } else if (m_Leased) {
+        m_Pool->Release(m_Lease);
+    }
+
+    glDeleteVertexArrays(1, &m_VertexArray);
+
+    DestroyGlyphSet(m_Glyphs);
+
+    for(auto & slot : m_Slots)
+        DestroyGlyphSet(slot->glyphs);
+}
+
+void TextBufferImpl::InitGlyphSet(glyph_set_s & set) {
+    glGenBuffers(1, &set.geometry_buffer);
+    glGenBuffers(1, &set.instance_buffer);
+
+    set.geometry_keys.clear();
+    set.geometry_fonts.clear();
+    set.resident_vertices.clear();
+    set.geometry_top = set.geometry_capacity = 0;
+    set.instance_source = set.instance_buffer;
+    set.instance_offset = 0;
+    set.upload_count = 0;
+    set.ink[0] = set.ink[1] = 1;
+    set.ink[2] = set.ink[3] = 0;
+}
+
+void TextBufferImpl::DestroyGlyphSet(glyph_set_s & set) {
+    glDeleteBuffers(1, &set.geometry_buffer);
+    glDeleteBuffers(1, &set.instance_buffer);
+
+    set.instance_ring.reset();
+}
+
+void TextBufferImpl::Clear() {
+    m_Layout->Clear();
+    m_LayoutChanged = false;
+
+    m_StaticForeCount = m_StaticBackCount = 0;
+    m_Glyphs.ranges.clear();
+    m_Glyphs.fonts.clear();
+    m_Glyphs.ink[0] = m_Glyphs.ink[1] = 1;
+    m_Glyphs.ink[2] = m_Glyphs.ink[3] = 0;
+    m_Instances.clear();
+
+    //slots stay reserved and keep their text
+    MergeSlotAttrs();
+
+    m_TextureGenerated = false;
+    m_Generation++;
+}
+
+void TextBufferImpl::Commit(TextLayoutPtr layout) {
+    if (layout != m_Layout) {
+        m_Layout->Clear();
+        m_LayoutChanged = false;
+    }
+
+    CommitLayout(*layout);
+}
+
+void TextBufferImpl::CommitLayout(TextLayout & layout) {
+    layout.Finish();
+
+    m_ForeAttribs.assign(layout.GetTextAttr(),
+                         layout.GetTextAttr() + layout.GetTextAttrCount());
+    m_BackAttribs.assign(layout.GetBackgroundAttr(),
+                         layout.GetBackgroundAttr() + layout.GetBackgroundAttrCount());
+    m_StaticForeCount = m_ForeAttribs.size();
+    m_StaticBackCount = m_BackAttribs.size();
+
+    MergeSlotAttrs();
+
+    UploadGlyphs(m_Glyphs, layout, 0);
+
+    const glyph_instance_s * instances = layout.GetGlyphInstances();
+
+    if (m_ComputeRaster)
+        m_Instances.assign(instances, instances + layout.GetGlyphInstanceCount());
+    else
+        m_Instances.clear();
+
+    m_TextureGenerated = false;
+    m_Generation++;
+}
+
+void TextBufferImpl::UploadGlyphs(glyph_set_s & set, TextLayout & layout, size_t reserve) {
+    set.fonts.clear();
+
+    for(uint32_t i = 0; i < layout.GetFontCount(); i++) {
+        const auto & font = layout.GetFont(i);
+        set.fonts.push_back({font, &font->GetGlyphTable()});
     }
 
-    matrix_color_vector * get_glyph_matrix(float ft_decent,
-                                           double pos_x, double pos_y) {
-        std::lock_guard<std::recursive_mutex> guard(m_UpdateLock);
+    //split the sorted instances into per glyph ranges, the geometry
+    //of each distinct glyph is packed once into the vertex buffer
+    const glyph_instance_s * instances = layout.GetGlyphInstances();
+    size_t instance_count = layout.GetGlyphInstanceCount();
+    size_t geometry_size = 0;
 
-        auto ft_pos_it = m_FontPosMatrix.insert({ft_decent, pos_x_matrix_map{}});
+    set.ranges.clear();
 
-        auto pos_x_it = ft_pos_it.first->second.insert({pos_x, pos_y_matrix_map{}});
+    for(size_t i = 0; i < instance_count; i++) {
+        auto key = instances[i].key;
 
-        auto pos_y_it = pos_x_it.first->second.insert({pos_y, matrix_color_vector{}});
+        if (!set.ranges.empty() && set.ranges.back().key == key) {
+            set.ranges.back().count++;
+            continue;
+        }
+
+        const auto & glyphs = *set.fonts[key >> GLYPH_ID_BITS].glyphs;
+        auto id = key & GLYPH_ID_MASK;
+
+        set.ranges.push_back({key,
+                static_cast<uint32_t>(i),
+                1,
+                static_cast<GLint>(geometry_size / sizeof(GLfloat) / 4),
+                static_cast<GLsizei>(glyphs.VertexCount(id)),
+                {0, 0, 0, 0}});
 
-        if (pos_y_it.second) {
-            glm::mat4 translate1 = std::move(m_Scale * glm::translate(glm::mat4(1.0),
-                                                                      glm::vec3(0,
-                                                                                -ft_decent,
-                                                                                0)));
-            glm::mat4 translate2 = std::move(glm::translate(glm::mat4(1.0), glm::vec3(pos_x, pos_y, 0)));
+        //vertices are x, y and the curve coordinates
+        const GLfloat * vertices = reinterpret_cast<const GLfloat *>(glyphs.Addr(id));
+        auto & bounds = set.ranges.back().bounds;
+
+        for(uint32_t v = 0; v < glyphs.VertexCount(id); v++) {
+            const GLfloat * vertex = vertices + v * 4;
+
+            bounds[0] = v ? std::min(bounds[0], vertex[0]) : vertex[0];
+            bounds[1] = v ? std::min(bounds[1], vertex[1]) : vertex[1];
+            bounds[2] = v ? std::max(bounds[2], vertex[0]) : vertex[0];
+            bounds[3] = v ? std::max(bounds[3], vertex[1]) : vertex[1];
+        }
 
-            glm::mat4 transform = std::move(translate1 * translate2);
+        geometry_size += glyphs.Size(id);
+    }
+
+    set.ink[0] = set.ink[1] = std::numeric_limits<float>::max();
+    set.ink[2] = set.ink[3] = std::numeric_limits<float>::lowest();
+
+    for(const auto & range : set.ranges) {
+        if (!range.vertex_count)
+            continue;
+
+        for(uint32_t i = range.first; i < range.first + range.count; i++) {
+            set.ink[0] = std::min(set.ink[0], instances[i].x + range.bounds[0]);
+            set.ink[1] = std::min(set.ink[1], instances[i].y + range.bounds[1]);
+            set.ink[2] = std::max(set.ink[2], instances[i].x + range.bounds[2]);
+            set.ink[3] = std::max(set.ink[3], instances[i].y + range.bounds[3]);
+        }
+    }
 
-            for(size_t i = 0; i < sizeof(JITTER_PATTERN) / sizeof(glm::vec2); i++) {
-                pos_y_it.first->second.push_back(
-                    {
-                        std::move(m_Translate3[i] * transform),
-                        m_C[i]
-                    });
+    //glyph geometry, a glyph id always names the same geometry of a font,
+    //so text with the same glyphs as the last upload keeps the buffer,
+    //slot text is replaced often and mostly with glyphs it had before
+    if (reserve) {
+        UploadResidentGlyphs(set, geometry_size);
+    } else {
+        bool same_fonts = std::equal(set.fonts.begin(), set.fonts.end(),
+                                     set.geometry_fonts.begin(), set.geometry_fonts.end(),
+                                     [](const font_slot_s & a, const font_slot_s & b) {
+                                         return a.font == b.font;
+                                     });
+        bool same_keys = std::equal(set.ranges.begin(), set.ranges.end(),
+                                    set.geometry_keys.begin(), set.geometry_keys.end(),
+                                    [](const glyph_range_s & range, uint32_t key) {
+                                        return range.key == key;
+                                    });
+
+        if (!same_fonts || !same_keys) {
+            glBindBuffer(GL_ARRAY_BUFFER, set.geometry_buffer);
+            glBufferData(GL_ARRAY_BUFFER, geometry_size, nullptr, GL_STATIC_DRAW);
+
+            set.geometry_keys.clear();
+
+            for(const auto & range : set.ranges) {
+                const auto & glyphs = *set.fonts[range.key >> GLYPH_ID_BITS].glyphs;
+                auto id = range.key & GLYPH_ID_MASK;
+
+                glBufferSubData(GL_ARRAY_BUFFER,
+                                range.first_vertex * sizeof(GLfloat) * 4,
+                                glyphs.Size(id),
+                                glyphs.Addr(id));
+
+                set.geometry_keys.push_back(range.key);
             }
+
+            set.geometry_fonts = set.fonts;
         }
+    }
+
+    //glyph origins, text changing every frame gets a ring region of its
+    //own instead of reallocating a buffer the last draw still reads,
+    //reserve sizes the regions once for text of a known maximum, text
+    //committed once stays in a plain buffer
+    if (!set.instance_ring && (reserve || set.upload_count == 1))
+        set.instance_ring = util::CreateUploadRing();
+
+    set.upload_count++;
+
+    size_t instance_size = instance_count * sizeof(glyph_instance_s);
+    void * mapped = set.instance_ring
+            ? set.instance_ring->Map(std::max(instance_size, reserve)) : nullptr;
 
-        return &pos_y_it.first->second;
+    if (mapped) {
+        memcpy(mapped, instances, instance_size);
+
+        set.instance_source = set.instance_ring->GetBuffer();
+        set.instance_offset = set.instance_ring->GetOffset();
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, set.instance_buffer);
+        glBufferData(GL_ARRAY_BUFFER, instance_size,
+                     instance_count ? instances : nullptr, GL_STATIC_DRAW);
+
+        set.instance_source = set.instance_buffer;
+        set.instance_offset = 0;
     }
-};
 
-using TextMatrixPtr = std::shared_ptr<TextMatrix>;
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-using viewport_font_pos_matrix_map = std::map<uint64_t, TextMatrixPtr>;
-static
-viewport_font_pos_matrix_map g_viewport_font_pos_matrix;
-static
-std::recursive_mutex g_MatrixLock;
+void TextBufferImpl::UploadResidentGlyphs(glyph_set_s & set, size_t geometry_size) {
+    //font slots of the layout to font slots of the resident geometry
+    std::vector<uint32_t> font_map;
 
-static
-TextMatrixPtr get_text_matrix_for_viewport(const viewport::viewport_s & viewport) {
-    std::lock_guard<std::recursive_mutex> guard(g_MatrixLock);
+    for(const auto & font : set.fonts) {
+        auto it = std::find_if(set.geometry_fonts.begin(), set.geometry_fonts.end(),
+                               [&font](const font_slot_s & resident) {
+                                   return resident.font == font.font;
+                               });
+
+        font_map.push_back(static_cast<uint32_t>(it - set.geometry_fonts.begin()));
 
-    uint64_t v = (viewport.width & 0xFFFFFFFF);
-    uint64_t key = (v << 32) | (viewport.height & 0xFFFFFFFF);
+        if (it == set.geometry_fonts.end())
+            set.geometry_fonts.push_back(font);
+    }
+
+    auto resident_key = [&font_map](uint32_t key) {
+        return (font_map[key >> GLYPH_ID_BITS] << GLYPH_ID_BITS) | (key & GLYPH_ID_MASK);
+    };
 
-    auto pair = g_viewport_font_pos_matrix.insert({key, std::make_shared<TextMatrix>(viewport)});
+    size_t missing_size = 0;
 
-    return pair.first->second;
+    for(const auto & range : set.ranges) {
+        if (!set.resident_vertices.count(resident_key(range.key)))
+            missing_size += set.fonts[range.key >> GLYPH_ID_BITS].glyphs->Size(range.key & GLYPH_ID_MASK);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, set.geometry_buffer);
+
+    //start over in a larger buffer when the new glyphs do not fit, only
+    //the glyphs of this text are kept
+    if (set.geometry_top + missing_size > set.geometry_capacity
+        || set.geometry_fonts.size() > MAX_FONT_SLOTS) {
+        set.geometry_fonts = set.fonts;
+        set.resident_vertices.clear();
+        set.geometry_top = 0;
+        set.geometry_capacity = geometry_size * 2;
+
+        for(uint32_t i = 0; i < font_map.size(); i++)
+            font_map[i] = i;
+
+        glBufferData(GL_ARRAY_BUFFER, set.geometry_capacity, nullptr, GL_STATIC_DRAW);
+    }
+
+    for(auto & range : set.ranges) {
+        auto inserted = set.resident_vertices.emplace(resident_key(range.key),
+                static_cast<GLint>(set.geometry_top / sizeof(GLfloat) / 4));
+
+        range.first_vertex = inserted.first->second;
+
+        if (!inserted.second)
+            continue;
+
+        const auto & glyphs = *set.fonts[range.key >> GLYPH_ID_BITS].glyphs;
+        auto id = range.key & GLYPH_ID_MASK;
+
+        glBufferSubData(GL_ARRAY_BUFFER,
+                        set.geometry_top,
+                        glyphs.Size(id),
+                        glyphs.Addr(id));
+
+        set.geometry_top += glyphs.Size(id);
+    }
 }
 
-class TextBufferImpl : public TextBuffer {
-public:
-    TextBufferImpl(const viewport::viewport_s & viewport)
-        : m_Viewport {viewport}
-        , m_TextMatrix {get_text_matrix_for_viewport(viewport)} {
-        Init();
+int TextBufferImpl::ReserveSlot(const int32_t * rect, uint32_t max_glyphs) {
+    if (!rect || rect[2] <= 0 || rect[3] <= 0 || !max_glyphs)
+        return -1;
+
+    text_slot_ptr slot {new text_slot_s {}};
+
+    std::copy(rect, rect + 4, slot->rect);
+    slot->max_glyphs = max_glyphs;
+    slot->layout = CreateTextLayout(m_Viewport);
+    slot->changed = false;
+    slot->dirty = false;
+
+    InitGlyphSet(slot->glyphs);
+
+    m_Slots.push_back(std::move(slot));
+
+    //the texture has to cover the new region
+    m_TextureGenerated = false;
+    m_Generation++;
+    return static_cast<int>(m_Slots.size() - 1);
+}
+
+bool TextBufferImpl::SetSlotText(int slot_id, pen_s & pen, const markup_s & markup, const std::wstring & text) {
+    if (slot_id < 0 || static_cast<size_t>(slot_id) >= m_Slots.size())
+        return false;
+
+    auto & slot = *m_Slots[slot_id];
+
+    slot.layout->Clear();
+    slot.changed = true;
+
+    if (!slot.layout->AddText(pen, markup, text))
+        return false;
+
+    slot.layout->Finish();
+
+    if (slot.layout->GetGlyphInstanceCount() > slot.max_glyphs) {
+        std::cerr << "slot " << slot_id << " holds " << slot.max_glyphs << " glyphs, text has "
+                  << slot.layout->GetGlyphInstanceCount() << std::endl;
+        slot.layout->Clear();
+        return false;
     }
 
-    virtual ~TextBufferImpl() {
-        Destroy();
+    return true;
+}
+
+void TextBufferImpl::CommitSlots() {
+    bool changed = false;
+
+    for(auto & slot_ptr : m_Slots) {
+        auto & slot = *slot_ptr;
+
+        if (!slot.changed)
+            continue;
+
+        slot.layout->Finish();
+
+        UploadGlyphs(slot.glyphs, *slot.layout, slot.max_glyphs * sizeof(glyph_instance_s));
+
+        //rects are clipped to the slot, as its part of the texture is
+        const float x0 = static_cast<float>(slot.rect[0]) / m_Viewport.width;
+        const float y0 = static_cast<float>(slot.rect[1]) / m_Viewport.height;
+        const float x1 = static_cast<float>(slot.rect[0] + slot.rect[2]) / m_Viewport.width;
+        const float y1 = static_cast<float>(slot.rect[1] + slot.rect[3]) / m_Viewport.height;
+
+        auto clip = [&](const text_attr_s * attrs, uint32_t count, text_attr_vector & clipped) {
+            clipped.clear();
+
+            for(uint32_t i = 0; i < count; i++) {
+                text_attr_s attr = attrs[i];
+
+                attr.bounds[0] = std::max(attr.bounds[0], x0);
+                attr.bounds[1] = std::max(attr.bounds[1], y0);
+                attr.bounds[2] = std::min(attr.bounds[2], x1);
+                attr.bounds[3] = std::min(attr.bounds[3], y1);
+
+                if (attr.bounds[0] < attr.bounds[2] && attr.bounds[1] < attr.bounds[3])
+                    clipped.push_back(attr);
+            }
+        };
+
+        clip(slot.layout->GetTextAttr(), slot.layout->GetTextAttrCount(), slot.fore_attrs);
+        clip(slot.layout->GetBackgroundAttr(), slot.layout->GetBackgroundAttrCount(), slot.back_attrs);
+
+        slot.changed = false;
+        slot.dirty = true;
+        changed = true;
     }
 
-    virtual bool AddText(pen_s & pen, const markup_s & markup, const std::wstring & text);
-    virtual uint32_t GetTexture() const { return m_RenderedTexture; }
-    virtual void Clear();
-    virtual uint32_t GetTextAttrCount() const { return m_TextAttribs.size(); }
-    virtual const text_attr_s * GetTextAttr() const { return &m_TextAttribs[0]; }
-    virtual void GenTexture();
+    if (!changed)
+        return;
 
-private:
-    bool AddChar(pen_s & pen,
-                 const markup_s & markup,
-                 const viewport::viewport_s & viewport,
-                 wchar_t ch);
+    MergeSlotAttrs();
+    m_Generation++;
+}
 
-	GLuint m_RenderedTexture;
-	GLuint m_FrameBuffer;
-    const viewport::viewport_s & m_Viewport;
-    double m_OriginX;
+void TextBufferImpl::MergeSlotAttrs() {
+    m_ForeAttribs.resize(m_StaticForeCount);
+    m_BackAttribs.resize(m_StaticBackCount);
 
-    ProgramPtr m_ProgramId;
+    for(const auto & slot : m_Slots) {
+        m_ForeAttribs.insert(m_ForeAttribs.end(), slot->fore_attrs.begin(), slot->fore_attrs.end());
+        m_BackAttribs.insert(m_BackAttribs.end(), slot->back_attrs.begin(), slot->back_attrs.end());
+    }
+}
 
-    std::vector<text_attr_s> m_TextAttribs;
-    glyph_matrix_color_map m_GlyphMatrixColors;
+//texture granularity, keeps small edits from reallocating it
+constexpr GLsizei TEXTURE_SIZE_STEP = 64;
 
-    bool m_TextureGenerated;
-    uint32_t m_VertexCount;
-    TextMatrixPtr m_TextMatrix;
-private:
-    void Init();
-    void Destroy();
-    void AddTextAttr(const pen_s & pen,
-                     const markup_s & markup,
-                     const viewport::viewport_s & viewport);
-};
+void TextBufferImpl::UpdateTextureRect() {
+    GLuint old_texture = m_RenderedTexture;
+    float old_rect[4];
 
+    std::copy(m_TextureRect, m_TextureRect + 4, old_rect);
 
-void TextBufferImpl::AddTextAttr(const pen_s & pen, const markup_s & markup,
-                                 const viewport::viewport_s & viewport) {
-    auto adv_y = viewport.line_height ? viewport.line_height : markup.font->GetHeight();
-
-    m_TextAttribs.push_back(
-        {
-            {
-                static_cast<float>(m_OriginX / viewport.width),
-                static_cast<float>((pen.y - adv_y) / viewport.height),
-                static_cast<float>(pen.x / viewport.width),
-                static_cast<float>(pen.y / viewport.height)
-            },
-
-            {
-                markup.fore_color.r,
-                markup.fore_color.g,
-                markup.fore_color.b,
-                markup.fore_color.a
-            },
-
-            {
-                markup.back_color.r,
-                markup.back_color.g,
-                markup.back_color.b,
-                markup.back_color.a
-            },
-        });
+    FitTexture();
+
+    //a new lease, a grown texture or a moved rect is a change to the
+    //renderers caching GetTexture and GetTextureRect by generation
+    if (m_RenderedTexture != old_texture
+        || !std::equal(m_TextureRect, m_TextureRect + 4, old_rect))
+        m_Generation++;
 }
 
-bool TextBufferImpl::AddText(pen_s & pen, const markup_s & markup, const std::wstring & text) {
-    m_OriginX = pen.x;
+void TextBufferImpl::FitTexture() {
+    //the rects bound everything the composite samples, one more pixel
+    //around them covers the neighbour sample and the jitter
+    double x0 = m_Viewport.width, y0 = m_Viewport.height, x1 = 0, y1 = 0;
 
-    for(size_t i=0;i < text.length(); i++) {
-        if (!AddChar(pen, markup, m_Viewport, text[i])) {
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            return false;
+    for(const auto & attr : m_ForeAttribs) {
+        x0 = std::min<double>(x0, attr.bounds[0] * m_Viewport.width);
+        y0 = std::min<double>(y0, attr.bounds[1] * m_Viewport.height);
+        x1 = std::max<double>(x1, attr.bounds[2] * m_Viewport.width);
+        y1 = std::max<double>(y1, attr.bounds[3] * m_Viewport.height);
+    }
+
+    //slots keep their whole region, so new slot text never moves the texture
+    for(const auto & slot : m_Slots) {
+        x0 = std::min<double>(x0, slot->rect[0]);
+        y0 = std::min<double>(y0, slot->rect[1]);
+        x1 = std::max<double>(x1, slot->rect[0] + slot->rect[2]);
+        y1 = std::max<double>(y1, slot->rect[1] + slot->rect[3]);
+    }
+
+    //nothing outside the viewport is visible
+    GLint left = std::max<GLint>(0, floor(x0) - 1);
+    GLint bottom = std::max<GLint>(0, floor(y0) - 1);
+    GLint right = std::min<GLint>(m_Viewport.width, ceil(x1) + 1);
+    GLint top = std::min<GLint>(m_Viewport.height, ceil(y1) + 1);
+
+    if (right <= left || top <= bottom) {
+        m_UsedWidth = m_UsedHeight = 0;
+        return;
+    }
+
+    m_TextureX = left;
+    m_TextureY = bottom;
+    m_UsedWidth = right - left;
+    m_UsedHeight = top - bottom;
+
+    if (m_Pool) {
+        //lease again when the text outgrows the lease or leaves most of it empty
+        bool outgrown = m_UsedWidth > m_TargetWidth || m_UsedHeight > m_TargetHeight;
+        bool wasteful = m_UsedWidth * m_UsedHeight * 4 < m_TargetWidth * m_TargetHeight;
+
+        if ((outgrown || wasteful) && !LeaseTarget(m_UsedWidth, m_UsedHeight)) {
+            m_UsedWidth = m_UsedHeight = 0;
+            return;
+        }
+    } else if (m_UsedWidth > m_TextureWidth || m_UsedHeight > m_TextureHeight) {
+        auto round_up = [](GLsizei v) {
+            return (v + TEXTURE_SIZE_STEP - 1) / TEXTURE_SIZE_STEP * TEXTURE_SIZE_STEP;
+        };
+
+        if (!ResizeTexture(std::max(m_TextureWidth, round_up(m_UsedWidth)),
+                           std::max(m_TextureHeight, round_up(m_UsedHeight)))) {
+            m_UsedWidth = m_UsedHeight = 0;
+            return;
         }
     }
 
-    if (pen.x != m_OriginX)
-        AddTextAttr(pen, markup, m_Viewport);
+    //the target part of the texture lines up with the text bounds
+    GLint x = m_TextureX - m_TargetX;
+    GLint y = m_TextureY - m_TargetY;
+
+    m_TextureRect[0] = static_cast<float>(x) / m_Viewport.width;
+    m_TextureRect[1] = static_cast<float>(y) / m_Viewport.height;
+    m_TextureRect[2] = static_cast<float>(x + m_TextureWidth) / m_Viewport.width;
+    m_TextureRect[3] = static_cast<float>(y + m_TextureHeight) / m_Viewport.height;
+}
+
+bool TextBufferImpl::ResizeTexture(GLsizei width, GLsizei height) {
+	glBindTexture(GL_TEXTURE_2D, m_RenderedTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0,GetTextureFormat(), width, height, 0,GL_RGB, GL_UNSIGNED_BYTE, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+    //the caller may be drawing into a frame buffer of its own
+    GLint old_frame_buffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_frame_buffer);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_FrameBuffer);
+
+	// Always check that our framebuffer is ok
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 
+	glBindFramebuffer(GL_FRAMEBUFFER, old_frame_buffer);
+
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "frame buffer status error:" << status << std::endl;
+		m_TextureWidth = m_TextureHeight = 0;
+		return false;
+	}
+
+    m_TextureWidth = m_TargetWidth = width;
+    m_TextureHeight = m_TargetHeight = height;
     return true;
 }
 
-bool TextBufferImpl::AddChar(pen_s & pen,
-                             const markup_s & markup,
-                             const viewport::viewport_s & viewport,
-                             wchar_t ch) {
-    auto adv_y = viewport.line_height ? viewport.line_height : markup.font->GetHeight();
+bool TextBufferImpl::LeaseTarget(GLsizei width, GLsizei height) {
+    if (m_Leased)
+        m_Pool->Release(m_Lease);
 
-    if (ch == L'\n') {
-        if (pen.x != m_OriginX)
-            AddTextAttr(pen, markup, viewport);
+    m_Leased = m_Pool->Acquire(width, height, GetTextureFormat(), m_Lease);
 
-        pen.y -= adv_y;
-        pen.x = m_OriginX;
-        return true;
+    if (!m_Leased) {
+        std::cerr << "no render target for " << width << "x" << height << std::endl;
+        m_FrameBuffer = m_RenderedTexture = 0;
+        m_TextureWidth = m_TextureHeight = 0;
+        m_TargetWidth = m_TargetHeight = 0;
+        return false;
     }
 
-    auto glyph = markup.font->LoadGlyph(ch);
+    m_FrameBuffer = m_Lease.frame_buffer;
+    m_RenderedTexture = m_Lease.texture;
+    m_TextureWidth = m_Lease.texture_width;
+    m_TextureHeight = m_Lease.texture_height;
+    m_TargetX = m_Lease.x;
+    m_TargetY = m_Lease.y;
+    m_TargetWidth = m_Lease.width;
+    m_TargetHeight = m_Lease.height;
+    return true;
+}
 
-    if (!glyph)
-        return true;
+GLenum TextBufferImpl::GetTextureFormat() const {
+    //image stores can not write three channel formats
+    if (m_ComputeRaster && m_Tier.format == GL_RGB)
+        return GL_RGBA8;
 
-    auto glyph_adv_x = glyph->GetAdvanceX();// * markup.font->GetHeight() / 2;
-    auto adv_x = viewport.glyph_width ? (char_width(ch) > 1 ? viewport.glyph_width * 2 : viewport.glyph_width) : glyph_adv_x;
+    return m_Tier.format;
+}
 
-    if (!glyph->NeedDraw()) {
-        pen.x += adv_x;
+bool TextBufferImpl::SetComputeRaster(bool enable) {
+    if (enable == m_ComputeRaster)
         return true;
+
+    if (enable && !m_Rasterizer) {
+        m_Rasterizer = CreateComputeRasterizer();
+
+        if (!m_Rasterizer)
+            return false;
     }
 
-    m_TextureGenerated = false;
+    m_ComputeRaster = enable;
 
-    auto p = m_GlyphMatrixColors.insert(std::pair<GlyphPtr, matrix_color_vector>(glyph, matrix_color_vector{}));
+    if (enable) {
+        //the instances of the last commit only live in the instance buffer
+        size_t instance_count = 0;
 
-    auto matrix = m_TextMatrix->get_glyph_matrix(markup.font->GetAscender(),
-                                                 pen.x, pen.y);
+        for(const auto & range : m_Glyphs.ranges)
+            instance_count += range.count;
 
-    p.first->second.insert(p.first->second.end(),
-                           matrix->begin(),
-                           matrix->end());
+        m_Instances.resize(instance_count);
 
-    m_VertexCount += glyph->GetSize() / sizeof(GLfloat) / 4;
+        if (instance_count) {
+            glBindBuffer(GL_ARRAY_BUFFER, m_Glyphs.instance_source);
+            glGetBufferSubData(GL_ARRAY_BUFFER, m_Glyphs.instance_offset,
+                               instance_count * sizeof(glyph_instance_s),
+                               m_Instances.data());
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+    } else {
+        m_Instances.clear();
+    }
 
-    pen.x += adv_x;
+    //the texture format may change, allocate it again on the next GenTexture
+    if (m_Pool) {
+        if (m_Leased)
+            m_Pool->Release(m_Lease);
+
+        m_Leased = false;
+        m_FrameBuffer = m_RenderedTexture = 0;
+        m_TextureWidth = m_TextureHeight = 0;
+        m_TargetWidth = m_TargetHeight = 0;
+    } else {
+        m_TextureWidth = m_TextureHeight = 0;
+    }
 
-    //TOOD: kerning
+    m_TextureGenerated = false;
+    m_Generation++;
     return true;
 }
 
-void TextBufferImpl::Init() {
-    m_TextureGenerated = false;
-    m_VertexCount = 0;
+void TextBufferImpl::GenTexture() {
+    if (m_LayoutChanged) {
+        CommitLayout(*m_Layout);
+        m_LayoutChanged = false;
+    }
 
-	glGenFramebuffers(1, &m_FrameBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, m_FrameBuffer);
+    CommitSlots();
 
-	// The texture we're going to render to
-	glGenTextures(1, &m_RenderedTexture);
+    if (m_TextureGenerated) {
+        if (!m_UsedWidth || !m_UsedHeight)
+            return;
 
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, m_RenderedTexture);
+        //only the regions of slots with new text are drawn again
+        for(auto & slot : m_Slots) {
+            if (slot->dirty)
+                DrawRegion(slot->rect);
 
-	// Give an empty image to OpenGL ( the last "0" means "empty" )
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, m_Viewport.width, m_Viewport.height, 0,GL_RGB, GL_UNSIGNED_BYTE, 0);
+            slot->dirty = false;
+        }
 
-	// Poor filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return;
+    }
 
-	// The depth buffer
-	GLuint depthrenderbuffer;
-	glGenRenderbuffers(1, &depthrenderbuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, m_Viewport.width, m_Viewport.height);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
+    m_TextureGenerated = true;
 
-	// Set "renderedTexture" as our colour attachement #0
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_RenderedTexture, 0);
+    for(auto & slot : m_Slots)
+        slot->dirty = false;
 
-	// Set the list of draw buffers.
-	GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-	glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
+    //only buffers drawn through a texture allocate one
+    UpdateTextureRect();
 
-	// Always check that our framebuffer is ok
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        assert("frame buffer status error\n");
+    if (!m_UsedWidth || !m_UsedHeight) return;
+
+    //the compute shader writes the whole target from one glyph set, slots
+    //are drawn by the raster path
+    if (m_ComputeRaster && m_Slots.empty()) {
+        raster_target_s target {m_RenderedTexture, GetTextureFormat(),
+                                m_TargetX, m_TargetY, m_TargetWidth, m_TargetHeight,
+                                m_TextureX, m_TextureY};
+
+        m_Rasterizer->Raster(target, m_Glyphs.geometry_buffer,
+                             m_Glyphs.ranges.data(), m_Glyphs.ranges.size(),
+                             m_Instances.data(),
+                             m_Tier.samples, &m_Tier.jitter[0].x,
+                             &m_Tier.front[0].x, &m_Tier.back[0].x);
         return;
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, m_FrameBuffer);
-    glClearColor(0,0,0,0);
-    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLint whole[4] = {m_TextureX, m_TextureY, m_TargetWidth, m_TargetHeight};
 
-    m_ProgramId = CreateTextBufferProgram();
+    DrawRegion(whole);
 }
 
-void TextBufferImpl::Destroy() {
-    glDeleteFramebuffers(1, &m_FrameBuffer);
-    glDeleteTextures(1, &m_RenderedTexture);
+static
+bool intersect(const GLint * a, const GLint * b, GLint * out) {
+    GLint x0 = std::max(a[0], b[0]);
+    GLint y0 = std::max(a[1], b[1]);
+    GLint x1 = std::min(a[0] + a[2], b[0] + b[2]);
+    GLint y1 = std::min(a[1] + a[3], b[1] + b[3]);
+
+    out[0] = x0;
+    out[1] = y0;
+    out[2] = x1 - x0;
+    out[3] = y1 - y0;
+    return x1 > x0 && y1 > y0;
 }
 
-void TextBufferImpl::Clear() {
-    glBindFramebuffer(GL_FRAMEBUFFER, m_FrameBuffer);
-    glClearColor(0,0,0,0);
-    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+//clear rect, viewport pixels, and draw the static text and the slots
+//inside it, slots only draw inside their own region
+void TextBufferImpl::DrawRegion(const GLint * rect) {
+    //viewport pixels of the target part of the texture
+    GLint target[4] = {m_TextureX, m_TextureY, m_TargetWidth, m_TargetHeight};
+    GLint region[4];
 
-    m_TextAttribs.clear();
-    m_GlyphMatrixColors.clear();
+    if (!intersect(rect, target, region))
+        return;
 
-    m_TextureGenerated = false;
-    m_VertexCount = 0;
-}
+    //scissor boxes are in texture pixels
+    auto scissor = [&](const GLint * r) {
+        glScissor(r[0] - m_TextureX + m_TargetX, r[1] - m_TextureY + m_TargetY, r[2], r[3]);
+    };
 
-void TextBufferImpl::GenTexture() {
-    if (m_TextureGenerated) return;
+    GLint old_frame_buffer = 0;
+    GLint old_viewport[4];
+    GLint old_scissor[4];
+    GLboolean old_scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_frame_buffer);
+    glGetIntegerv(GL_VIEWPORT, old_viewport);
+    glGetIntegerv(GL_SCISSOR_BOX, old_scissor);
 
     glBindFramebuffer(GL_FRAMEBUFFER, m_FrameBuffer);
+    glViewport(m_TargetX, m_TargetY, m_TargetWidth, m_TargetHeight);
+
+    //other buffers may own the rest of a pooled texture
+    glEnable(GL_SCISSOR_TEST);
+    scissor(region);
+
+    glClearColor(0,0,0,0);
+    glClear(GL_COLOR_BUFFER_BIT);
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_ONE, GL_ONE);
 
-	GLuint VertexArrayID;
-	glGenVertexArrays(1, &VertexArrayID);
-	glBindVertexArray(VertexArrayID);
+    glUseProgram(*m_Program.program);
 
-    GLuint buffers[2] = {0};
-    glGenBuffers(sizeof(buffers) / sizeof(GLuint), buffers);
+    glUniform2f(m_Program.viewport_index, m_TargetWidth, m_TargetHeight);
+    glUniform2f(m_Program.origin_index, m_TextureX, m_TextureY);
+    glUniform2fv(m_Program.jitter_index, m_Tier.samples, &m_Tier.jitter[0].x);
+    glUniform4fv(m_Program.front_index, m_Tier.samples, &m_Tier.front[0].x);
+    glUniform4fv(m_Program.back_index, m_Tier.samples, &m_Tier.back[0].x);
+    glUniformMatrix3fv(m_Program.transform_index, 1, GL_FALSE, IDENTITY_TRANSFORM);
 
-    glUseProgram(*m_ProgramId);
+    //static text far from a slot is skipped when only the slot changed
+    bool static_inside = false;
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
-    glEnableVertexAttribArray(5);
+    for(size_t i = 0; i < m_StaticForeCount && !static_inside; i++) {
+        const auto & bounds = m_ForeAttribs[i].bounds;
+        GLint x0 = floor(bounds[0] * m_Viewport.width) - 1;
+        GLint y0 = floor(bounds[1] * m_Viewport.height) - 1;
+        GLint attr_rect[4] = {x0, y0,
+                              static_cast<GLint>(ceil(bounds[2] * m_Viewport.width)) + 1 - x0,
+                              static_cast<GLint>(ceil(bounds[3] * m_Viewport.height)) + 1 - y0};
+        GLint clipped[4];
+
+        static_inside = intersect(attr_rect, region, clipped);
+    }
+
+    if (static_inside)
+        DrawGlyphRanges(m_Glyphs, m_Tier.samples);
+
+    for(const auto & slot : m_Slots) {
+        GLint clipped[4];
+
+        if (!intersect(slot->rect, region, clipped))
+            continue;
+
+        scissor(clipped);
+        DrawGlyphRanges(slot->glyphs, m_Tier.samples);
+    }
+
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, old_frame_buffer);
+
+    glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+    glScissor(old_scissor[0], old_scissor[1], old_scissor[2], old_scissor[3]);
+
+    if (!old_scissor_test)
+        glDisable(GL_SCISSOR_TEST);
+}
+
+void TextBufferImpl::InitProgram(glyph_program_s & program, GLuint samples) {
+    program.program = CreateTextBufferProgram(samples);
+
+    glUseProgram(*program.program);
 
+    program.viewport_index = glGetUniformLocation(*program.program, "viewport");
+    program.origin_index = glGetUniformLocation(*program.program, "origin");
+    program.jitter_index = glGetUniformLocation(*program.program, "jitter");
+    program.front_index = glGetUniformLocation(*program.program, "front");
+    program.back_index = glGetUniformLocation(*program.program, "back");
+    program.transform_index = glGetUniformLocation(*program.program, "transform");
+
+    glUseProgram(0);
+}
+
+void TextBufferImpl::DrawGlyphRanges(const glyph_set_s & set, GLuint samples) {
+    if (set.ranges.empty())
+        return;
+
+    glBindVertexArray(m_VertexArray);
+
+    glBindBuffer(GL_ARRAY_BUFFER, set.geometry_buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
     glVertexAttribDivisor(0, 0);
-    glVertexAttribDivisor(1, 1);
-    glVertexAttribDivisor(2, 1);
-    glVertexAttribDivisor(3, 1);
-    glVertexAttribDivisor(4, 1);
-    glVertexAttribDivisor(5, 1);
-
-    for(auto p : m_GlyphMatrixColors) {
-        auto & glyph = p.first;
-        auto & matrix_colors = p.second;
-
-        glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
-        glBufferData(GL_ARRAY_BUFFER, glyph->GetSize(),
-                     glyph->GetAddr(), GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
-        glBufferData(GL_ARRAY_BUFFER, matrix_colors.size() * sizeof(matrix_color_s),
-                     &matrix_colors[0], GL_STATIC_DRAW);
-
-        //a mat4 take 4 attribute of vec4
-        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(matrix_color_s), reinterpret_cast<void *>(0));
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(matrix_color_s), reinterpret_cast<void *>(sizeof(glm::vec4)));
-        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(matrix_color_s), reinterpret_cast<void *>(sizeof(glm::vec4) * 2));
-        glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(matrix_color_s), reinterpret_cast<void *>(sizeof(glm::vec4) * 3));
-        //color
-        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(matrix_color_s), reinterpret_cast<void *>(sizeof(glm::vec4) * 4));
-
-        glDrawArraysInstanced(GL_TRIANGLES, 0,
-                              glyph->GetSize() / sizeof(GLfloat) / 4,
-                              matrix_colors.size());
+
+    //every instance is drawn once per jitter sample
+    glBindBuffer(GL_ARRAY_BUFFER, set.instance_source);
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, samples);
+
+    for(const auto & range : set.ranges) {
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(glyph_instance_s),
+                              reinterpret_cast<void *>(set.instance_offset
+                                                       + range.first * sizeof(glyph_instance_s)
+                                                       + offsetof(glyph_instance_s, x)));
+
+        glDrawArraysInstanced(GL_TRIANGLES,
+                              range.first_vertex,
+                              range.vertex_count,
+                              range.count * samples);
     }
 
     glDisableVertexAttribArray(0);
     glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
-    glDisableVertexAttribArray(3);
-    glDisableVertexAttribArray(4);
-    glDisableVertexAttribArray(5);
 
-    glUseProgram(0);
-    glDeleteBuffers(sizeof(buffers) / sizeof(GLuint), buffers);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
+}
 
-    m_TextureGenerated = true;
+void TextBufferImpl::DrawGlyphs(const float * transform) {
+    if (m_LayoutChanged) {
+        CommitLayout(*m_Layout);
+        m_LayoutChanged = false;
+    }
+
+    CommitSlots();
+
+    if (!m_DirectProgram.program)
+        InitProgram(m_DirectProgram, 1);
+
+    static const glm::vec2 jitter {0, 0};
+    static const glm::vec4 front {16, 16, 16, 16};
+    static const glm::vec4 back {1, 1, 1, 1};
+
+    glUseProgram(*m_DirectProgram.program);
+
+    glUniform2f(m_DirectProgram.viewport_index, m_Viewport.width, m_Viewport.height);
+    glUniform2f(m_DirectProgram.origin_index, 0, 0);
+    glUniform2fv(m_DirectProgram.jitter_index, 1, &jitter.x);
+    glUniform4fv(m_DirectProgram.front_index, 1, &front.x);
+    glUniform4fv(m_DirectProgram.back_index, 1, &back.x);
+    glUniformMatrix3fv(m_DirectProgram.transform_index, 1, GL_FALSE,
+                       transform ? transform : IDENTITY_TRANSFORM);
+
+    DrawGlyphRanges(m_Glyphs, 1);
+
+    if (m_Slots.empty()) {
+        glUseProgram(0);
+        return;
+    }
+
+    //slot text is clipped to its region, so slot glyphs are scissored to
+    //the window bounds of their transformed region
+    GLint old_scissor[4];
+    GLboolean old_scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+    glGetIntegerv(GL_SCISSOR_BOX, old_scissor);
+
+    glEnable(GL_SCISSOR_TEST);
+
+    const GLfloat * m = transform ? transform : IDENTITY_TRANSFORM;
+
+    for(const auto & slot : m_Slots) {
+        const double rect[4] = {static_cast<double>(slot->rect[0]),
+                                static_cast<double>(slot->rect[1]),
+                                static_cast<double>(slot->rect[0] + slot->rect[2]),
+                                static_cast<double>(slot->rect[1] + slot->rect[3])};
+        GLint box[4];
+
+        if (!WindowBox(rect, m, box))
+            continue;
+
+        if (old_scissor_test && !intersect(box, old_scissor, box))
+            continue;
+
+        glScissor(box[0], box[1], box[2], box[3]);
+        DrawGlyphRanges(slot->glyphs, 1);
+    }
+
+    glScissor(old_scissor[0], old_scissor[1], old_scissor[2], old_scissor[3]);
+
+    if (!old_scissor_test)
+        glDisable(GL_SCISSOR_TEST);
+
+    glUseProgram(0);
+}
+
+bool TextBufferImpl::WindowBox(const double * rect, const GLfloat * transform, GLint * box) const {
+    GLint window[4];
+    glGetIntegerv(GL_VIEWPORT, window);
+
+    double x0 = window[0] + window[2], y0 = window[1] + window[3];
+    double x1 = window[0], y1 = window[1];
+
+    for(int corner = 0; corner < 4; corner++) {
+        //viewport pixels to clip space, as the vertex shader does
+        double cx = (corner & 1 ? rect[2] : rect[0]) * 2.0 / m_Viewport.width - 1;
+        double cy = (corner & 2 ? rect[3] : rect[1]) * 2.0 / m_Viewport.height - 1;
+        double tx = transform[0] * cx + transform[3] * cy + transform[6];
+        double ty = transform[1] * cx + transform[4] * cy + transform[7];
+
+        tx = window[0] + (tx + 1) * 0.5 * window[2];
+        ty = window[1] + (ty + 1) * 0.5 * window[3];
+
+        x0 = std::min(x0, tx);
+        y0 = std::min(y0, ty);
+        x1 = std::max(x1, tx);
+        y1 = std::max(y1, ty);
+    }
+
+    box[0] = static_cast<GLint>(floor(x0));
+    box[1] = static_cast<GLint>(floor(y0));
+    box[2] = static_cast<GLint>(ceil(x1)) - box[0];
+    box[3] = static_cast<GLint>(ceil(y1)) - box[1];
+
+    return box[2] > 0 && box[3] > 0;
+}
+
+void TextBufferImpl::ClearGlyphStencil(const float * transform) {
+    const GLfloat * m = transform ? transform : IDENTITY_TRANSFORM;
+
+    GLint old_scissor[4];
+    GLint old_clear_stencil = 0;
+    GLboolean old_scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+    glGetIntegerv(GL_SCISSOR_BOX, old_scissor);
+    glGetIntegerv(GL_STENCIL_CLEAR_VALUE, &old_clear_stencil);
+
+    glEnable(GL_SCISSOR_TEST);
+    glStencilMask(0xff);
+    glClearStencil(0);
+
+    //one more pixel around the outlines covers rasterization rounding,
+    //slot glyphs never reach past their region
+    auto clear = [&](const glyph_set_s & set, const GLint * region) {
+        if (set.ink[0] > set.ink[2])
+            return;
+
+        double rect[4] = {set.ink[0] - 1.0, set.ink[1] - 1.0, set.ink[2] + 1.0, set.ink[3] + 1.0};
+
+        if (region) {
+            rect[0] = std::max<double>(rect[0], region[0]);
+            rect[1] = std::max<double>(rect[1], region[1]);
+            rect[2] = std::min<double>(rect[2], region[0] + region[2]);
+            rect[3] = std::min<double>(rect[3], region[1] + region[3]);
+
+            if (rect[0] >= rect[2] || rect[1] >= rect[3])
+                return;
+        }
+
+        GLint box[4];
+
+        if (!WindowBox(rect, m, box))
+            return;
+
+        if (old_scissor_test && !intersect(box, old_scissor, box))
+            return;
+
+        glScissor(box[0], box[1], box[2], box[3]);
+        glClear(GL_STENCIL_BUFFER_BIT);
+    };
+
+    clear(m_Glyphs, nullptr);
+
+    for(const auto & slot : m_Slots)
+        clear(slot->glyphs, slot->rect);
+
+    glClearStencil(old_clear_stencil);
+    glScissor(old_scissor[0], old_scissor[1], old_scissor[2], old_scissor[3]);
+
+    if (!old_scissor_test)
+        glDisable(GL_SCISSOR_TEST);
 }
 
 } //namespace impl
 
 TextBufferPtr CreateTextBuffer(const viewport::viewport_s & viewport) {
-    return std::make_shared<impl::TextBufferImpl>(viewport);
+    return std::make_shared<impl::TextBufferImpl>(viewport, RenderTargetPoolPtr {});
+}
+
+TextBufferPtr CreateTextBuffer(const viewport::viewport_s & viewport, RenderTargetPoolPtr pool) {
+    return std::make_shared<impl::TextBufferImpl>(viewport, pool);
 }
 
 } //namespace text
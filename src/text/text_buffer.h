@@ -6,16 +6,15 @@
 #include "pen.h"
 #include "markup.h"
 #include "viewport.h"
+#include "text_layout.h"
+#include "render_target_pool.h"
 
 namespace ftdgl {
 namespace text {
 
-typedef struct  __text_attr_s {
-    float bounds[4];
-    float color[4];
-    float back_color[4];
-} text_attr_s;
-
+//the GL side of laid out text, AddText and friends fill an internal
+//TextLayout committed by GenTexture, Commit replaces the content with a
+//layout filled elsewhere and drops text added to the buffer itself
 class TextBuffer {
 public:
     TextBuffer() = default;
@@ -23,16 +22,61 @@ public:
 
 public:
     virtual bool AddText(pen_s & pen, const markup_s & markup, const std::wstring & text) = 0;
+    //register a markup once and get a small id for AddRuns,
+    //equal markups share the same id, styles survive Clear()
+    virtual uint32_t AddStyle(const markup_s & markup) = 0;
+    //lay out runs in order, a new line returns to pen.x at the call
+    virtual bool AddRuns(pen_s & pen, const text_run_s * runs, size_t count) = 0;
+    //lay out large AddText calls on count threads split at line
+    //boundaries, 0 means one per hardware thread, 1 disables it
+    virtual void SetLayoutThreads(size_t count) = 0;
     virtual void Clear() = 0;
+    //upload the instances of layout, call on the GL thread, the layout
+    //can be refilled right after
+    virtual void Commit(TextLayoutPtr layout) = 0;
     virtual uint32_t GetTexture() const = 0;
+    //the viewport area the whole texture lines up with, x0, y0, x1, y1 in
+    //the same units as text_attr_s bounds, valid after GenTexture
+    virtual const float * GetTextureRect() const = 0;
     virtual void GenTexture() = 0;
+    //draw the glyph triangles once at viewport pixels into the bound
+    //frame buffer, front minus back faces covering a pixel is its winding
+    //number, non zero inside the glyphs, needs no texture, transform is a
+    //column major 3x3 matrix applied in clip space, null for none
+    virtual void DrawGlyphs(const float * transform = nullptr) = 0;
+    //zero the stencil over everything the last DrawGlyphs with the same
+    //transform could have drawn, glyph outlines reach past the text rects
+    virtual void ClearGlyphStencil(const float * transform = nullptr) = 0;
+    //changes whenever the rects below change, after GenTexture
+    virtual uint64_t GetGeneration() const = 0;
+    //viewport::antialias_e the texture was drawn with, taken from the
+    //viewport when the buffer is created
+    virtual int GetAntialias() const = 0;
+    //write the texture with a compute shader binning glyphs into screen
+    //tiles instead of drawing them once per sample, false without GL 4.3
+    virtual bool SetComputeRaster(bool enable) = 0;
+    //reserve a region, x, y, width, height in viewport pixels, for text
+    //replaced often, GenTexture then only draws the regions of slots with
+    //new text again, returns the slot id or -1, slots survive Clear()
+    virtual int ReserveSlot(const int32_t * rect, uint32_t max_glyphs) = 0;
+    //replace the text of a slot, the text is clipped to the slot region,
+    //false and an empty slot when it has more than max_glyphs glyphs
+    virtual bool SetSlotText(int slot, pen_s & pen, const markup_s & markup, const std::wstring & text) = 0;
+    //rects for the foreground pass, adjacent rects of a line with the
+    //same fore color are merged, valid after GenTexture
     virtual uint32_t GetTextAttrCount() const = 0;
     virtual const text_attr_s * GetTextAttr() const = 0;
+    //rects for the background pass, transparent backgrounds dropped and
+    //adjacent rects of a line with the same back color merged
+    virtual uint32_t GetBackgroundAttrCount() const = 0;
+    virtual const text_attr_s * GetBackgroundAttr() const = 0;
 };
 
 using TextBufferPtr = std::shared_ptr<TextBuffer>;
 
 TextBufferPtr CreateTextBuffer(const viewport::viewport_s & viewport);
+//draw into a sub rect leased from pool instead of a texture of its own
+TextBufferPtr CreateTextBuffer(const viewport::viewport_s & viewport, RenderTargetPoolPtr pool);
 
 } //namespace text
 } //namespace ftdgl
@@ -0,0 +1,572 @@
+#include "text_layout.h"
+#include "char_width.h"
+#include "thread_pool.h"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace ftdgl {
+namespace text {
+namespace impl {
+
+using glyph_instance_vector = std::vector<glyph_instance_s>;
+using font_vector = std::vector<FontPtr>;
+
+//stable LSD radix sort on the glyph key, 8 bits per pass, passes where
+//all keys share the digit are skipped, scratch keeps its capacity
+static
+void radix_sort_instances(glyph_instance_vector & instances,
+                          glyph_instance_vector & scratch) {
+    size_t count = instances.size();
+
+    if (count < 2)
+        return;
+
+    scratch.resize(count);
+
+    glyph_instance_s * src = &instances[0];
+    glyph_instance_s * dst = &scratch[0];
+
+    for(uint32_t shift = 0; shift < 32; shift += 8) {
+        size_t offsets[256] = {0};
+
+        for(size_t i = 0; i < count; i++)
+            offsets[(src[i].key >> shift) & 0xFF]++;
+
+        if (offsets[(src[0].key >> shift) & 0xFF] == count)
+            continue;
+
+        size_t sum = 0;
+        for(size_t i = 0; i < 256; i++) {
+            size_t c = offsets[i];
+            offsets[i] = sum;
+            sum += c;
+        }
+
+        for(size_t i = 0; i < count; i++)
+            dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+        std::swap(src, dst);
+    }
+
+    if (src != &instances[0])
+        instances.swap(scratch);
+}
+
+typedef struct __style_s {
+    markup_s markup;
+    //raw pointers and cached metrics, markup keeps the font alive
+    Font * font;
+    const glyph_table_s * glyphs;
+    uint32_t font_slot;
+    float ascender;
+    double adv_y;
+} style_s;
+
+using style_vector = std::vector<style_s>;
+using text_attr_vector = std::vector<text_attr_s>;
+
+//layout state of one AddText/AddRuns call or of one parallel chunk
+typedef struct __layout_cursor_s {
+    pen_s pen;
+    //x where a new line starts, x where the current attr rect starts
+    double origin_x;
+    double segment_x;
+    glyph_instance_vector * instances;
+    text_attr_vector * attrs;
+    //false on worker threads, glyphs are loaded before the split
+    bool load_glyphs;
+} layout_cursor_s;
+
+//a range of lines laid out on a worker thread
+typedef struct __layout_chunk_s {
+    size_t begin;
+    size_t end;
+    size_t lines;
+    size_t instance_offset;
+    size_t attr_offset;
+    pen_s pen;
+    bool ok;
+    std::vector<uint32_t> missing;
+    glyph_instance_vector instances;
+    text_attr_vector attrs;
+} layout_chunk_s;
+
+using layout_chunk_vector = std::vector<layout_chunk_s>;
+
+//below this AddText lays out on the calling thread
+constexpr size_t PARALLEL_LAYOUT_MIN_CHARS = 16 * 1024;
+//chunks per layout thread, evens out lines of different lengths
+constexpr size_t PARALLEL_LAYOUT_CHUNKS = 4;
+
+class TextLayoutImpl : public TextLayout {
+public:
+    TextLayoutImpl(const viewport::viewport_s & viewport)
+        : m_Viewport {viewport}
+        , m_TextAttribs {}
+        , m_ForeAttribs {}
+        , m_BackAttribs {}
+        , m_Instances {}
+        , m_SortScratch {}
+        , m_Styles {}
+        , m_Fonts {}
+        , m_LayoutPool {}
+        , m_Chunks {}
+        , m_Finished {true} {
+    }
+
+    virtual ~TextLayoutImpl() = default;
+
+public:
+    virtual bool AddText(pen_s & pen, const markup_s & markup, const std::wstring & text);
+    virtual uint32_t AddStyle(const markup_s & markup);
+    virtual bool AddRuns(pen_s & pen, const text_run_s * runs, size_t count);
+    virtual void SetLayoutThreads(size_t count);
+    virtual void Clear();
+    virtual void Finish();
+
+    virtual uint32_t GetGlyphInstanceCount() const { return m_Instances.size(); }
+    virtual const glyph_instance_s * GetGlyphInstances() const { return m_Instances.data(); }
+    virtual uint32_t GetFontCount() const { return m_Fonts.size(); }
+    virtual const FontPtr & GetFont(uint32_t slot) const { return m_Fonts[slot]; }
+    virtual uint32_t GetTextAttrCount() const { return m_ForeAttribs.size(); }
+    virtual const text_attr_s * GetTextAttr() const { return m_ForeAttribs.data(); }
+    virtual uint32_t GetBackgroundAttrCount() const { return m_BackAttribs.size(); }
+    virtual const text_attr_s * GetBackgroundAttr() const { return m_BackAttribs.data(); }
+
+private:
+    void InitCursor(layout_cursor_s & cursor, const pen_s & pen);
+    bool LayoutRun(layout_cursor_s & cursor,
+                   const style_s & style,
+                   const wchar_t * text,
+                   size_t length) const;
+    bool LayoutChar(layout_cursor_s & cursor,
+                    const style_s & style,
+                    wchar_t ch) const;
+    void AddTextAttr(layout_cursor_s & cursor,
+                     const style_s & style) const;
+    bool LayoutParallel(pen_s & pen,
+                        const style_s & style,
+                        const std::wstring & text);
+    void CompactAttrs();
+    void MakeStyle(const markup_s & markup, style_s & style);
+    uint32_t GetFontSlot(const FontPtr & font);
+
+    const viewport::viewport_s & m_Viewport;
+
+    //as laid out, and compacted for each render pass
+    text_attr_vector m_TextAttribs;
+    text_attr_vector m_ForeAttribs;
+    text_attr_vector m_BackAttribs;
+    glyph_instance_vector m_Instances;
+    glyph_instance_vector m_SortScratch;
+    style_vector m_Styles;
+    font_vector m_Fonts;
+
+    util::ThreadPoolPtr m_LayoutPool;
+    layout_chunk_vector m_Chunks;
+
+    bool m_Finished;
+};
+
+static
+bool is_same_color(const color_s & a, const color_s & b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+uint32_t TextLayoutImpl::GetFontSlot(const FontPtr & font) {
+    for(size_t i = 0; i < m_Fonts.size(); i++) {
+        if (m_Fonts[i] == font)
+            return i;
+    }
+
+    m_Fonts.push_back(font);
+
+    return m_Fonts.size() - 1;
+}
+
+void TextLayoutImpl::MakeStyle(const markup_s & markup, style_s & style) {
+    style.markup = markup;
+    style.font = markup.font.get();
+    style.glyphs = &markup.font->GetGlyphTable();
+    style.font_slot = GetFontSlot(markup.font);
+    style.ascender = markup.font->GetAscender();
+    style.adv_y = m_Viewport.line_height ? m_Viewport.line_height : markup.font->GetHeight();
+}
+
+void TextLayoutImpl::AddTextAttr(layout_cursor_s & cursor, const style_s & style) const {
+    const auto & markup = style.markup;
+    const auto & pen = cursor.pen;
+
+    cursor.attrs->push_back(
+        {
+            {
+                static_cast<float>(cursor.segment_x / m_Viewport.width),
+                static_cast<float>((pen.y - style.adv_y) / m_Viewport.height),
+                static_cast<float>(pen.x / m_Viewport.width),
+                static_cast<float>(pen.y / m_Viewport.height)
+            },
+
+            {
+                markup.fore_color.r,
+                markup.fore_color.g,
+                markup.fore_color.b,
+                markup.fore_color.a
+            },
+
+            {
+                markup.back_color.r,
+                markup.back_color.g,
+                markup.back_color.b,
+                markup.back_color.a
+            },
+        });
+}
+
+uint32_t TextLayoutImpl::AddStyle(const markup_s & markup) {
+    for(size_t i = 0; i < m_Styles.size(); i++) {
+        const auto & m = m_Styles[i].markup;
+
+        if (m.font == markup.font
+            && is_same_color(m.fore_color, markup.fore_color)
+            && is_same_color(m.back_color, markup.back_color))
+            return i;
+    }
+
+    m_Styles.push_back({});
+    MakeStyle(markup, m_Styles.back());
+
+    return m_Styles.size() - 1;
+}
+
+void TextLayoutImpl::SetLayoutThreads(size_t count) {
+    //compared as the count it stands for, so a pool made with another
+    //count is replaced
+    if (count == 0)
+        count = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+    if (count == 1) {
+        m_LayoutPool.reset();
+        return;
+    }
+
+    if (m_LayoutPool && m_LayoutPool->GetThreadCount() == count)
+        return;
+
+    m_LayoutPool = util::CreateThreadPool(count);
+}
+
+void TextLayoutImpl::InitCursor(layout_cursor_s & cursor, const pen_s & pen) {
+    cursor.pen = pen;
+    cursor.origin_x = cursor.segment_x = pen.x;
+    cursor.instances = &m_Instances;
+    cursor.attrs = &m_TextAttribs;
+    cursor.load_glyphs = true;
+}
+
+bool TextLayoutImpl::AddText(pen_s & pen, const markup_s & markup, const std::wstring & text) {
+    style_s style;
+    MakeStyle(markup, style);
+
+    m_Finished = false;
+
+    if (m_LayoutPool && text.length() >= PARALLEL_LAYOUT_MIN_CHARS)
+        return LayoutParallel(pen, style, text);
+
+    layout_cursor_s cursor;
+    InitCursor(cursor, pen);
+
+    bool ok = LayoutRun(cursor, style, text.c_str(), text.length());
+
+    pen = cursor.pen;
+    return ok;
+}
+
+bool TextLayoutImpl::AddRuns(pen_s & pen, const text_run_s * runs, size_t count) {
+    layout_cursor_s cursor;
+    InitCursor(cursor, pen);
+
+    m_Finished = false;
+
+    bool ok = true;
+
+    for(size_t i = 0; ok && i < count; i++) {
+        if (runs[i].style_id >= m_Styles.size()) {
+            std::cerr << "unknown style id:" << runs[i].style_id << std::endl;
+            ok = false;
+            break;
+        }
+
+        ok = LayoutRun(cursor, m_Styles[runs[i].style_id], runs[i].text, runs[i].length);
+    }
+
+    pen = cursor.pen;
+    return ok;
+}
+
+bool TextLayoutImpl::LayoutParallel(pen_s & pen,
+                                    const style_s & style,
+                                    const std::wstring & text) {
+    const wchar_t * chars = text.c_str();
+    size_t length = text.length();
+    size_t chunk_count = m_LayoutPool->GetThreadCount() * PARALLEL_LAYOUT_CHUNKS;
+
+    //split after a new line near every 1/chunk_count of the text
+    if (m_Chunks.size() < chunk_count)
+        m_Chunks.resize(chunk_count);
+
+    size_t used = 0;
+
+    for(size_t begin = 0; begin < length; used++) {
+        size_t end = std::max(begin + 1, (used + 1) * length / chunk_count);
+
+        if (used + 1 == chunk_count || end >= length) {
+            end = length;
+        } else {
+            end = text.find(L'\n', end - 1);
+            end = end == std::wstring::npos ? length : end + 1;
+        }
+
+        m_Chunks[used].begin = begin;
+        m_Chunks[used].end = end;
+        begin = end;
+    }
+
+    const auto & glyphs = *style.glyphs;
+
+    //count lines and collect glyphs missing from the glyph table
+    m_LayoutPool->Run(used, [&](size_t i) {
+            auto & chunk = m_Chunks[i];
+
+            chunk.lines = 0;
+            chunk.missing.clear();
+
+            for(size_t c = chunk.begin; c < chunk.end; c++) {
+                if (chars[c] == L'\n')
+                    chunk.lines++;
+                else if (glyphs.Find(chars[c]) == INVALID_GLYPH_ID)
+                    chunk.missing.push_back(chars[c]);
+            }
+
+            std::sort(chunk.missing.begin(), chunk.missing.end());
+            chunk.missing.erase(std::unique(chunk.missing.begin(), chunk.missing.end()),
+                                chunk.missing.end());
+        });
+
+    //loading takes the font lock, do it once up front
+    for(size_t i = 0; i < used; i++) {
+        for(auto ch : m_Chunks[i].missing) {
+            if (glyphs.Find(ch) == INVALID_GLYPH_ID)
+                style.font->LoadGlyphId(ch);
+        }
+    }
+
+    //chunks start at a line start, the first one at pen.x too, y goes
+    //down a line at a time as in LayoutChar so both round the same
+    double y = pen.y;
+
+    for(size_t i = 0; i < used; i++) {
+        m_Chunks[i].pen = {pen.x, y};
+
+        for(size_t line = 0; line < m_Chunks[i].lines; line++)
+            y -= style.adv_y;
+    }
+
+    m_LayoutPool->Run(used, [&](size_t i) {
+            auto & chunk = m_Chunks[i];
+
+            layout_cursor_s cursor;
+            cursor.pen = chunk.pen;
+            cursor.origin_x = cursor.segment_x = pen.x;
+            cursor.instances = &chunk.instances;
+            cursor.attrs = &chunk.attrs;
+            cursor.load_glyphs = false;
+
+            chunk.instances.clear();
+            chunk.attrs.clear();
+            chunk.ok = LayoutRun(cursor, style, chars + chunk.begin, chunk.end - chunk.begin);
+            chunk.pen = cursor.pen;
+        });
+
+    //prefix sum of the chunk outputs, then copy them in place
+    size_t instance_offset = m_Instances.size();
+    size_t attr_offset = m_TextAttribs.size();
+    bool ok = true;
+
+    for(size_t i = 0; i < used; i++) {
+        auto & chunk = m_Chunks[i];
+
+        chunk.instance_offset = instance_offset;
+        chunk.attr_offset = attr_offset;
+        instance_offset += chunk.instances.size();
+        attr_offset += chunk.attrs.size();
+
+        if (!chunk.ok) {
+            ok = false;
+            break;
+        }
+    }
+
+    if (!ok)
+        return false;
+
+    m_Instances.resize(instance_offset);
+    m_TextAttribs.resize(attr_offset);
+
+    m_LayoutPool->Run(used, [&](size_t i) {
+            auto & chunk = m_Chunks[i];
+
+            if (!chunk.instances.empty())
+                memcpy(&m_Instances[chunk.instance_offset], &chunk.instances[0],
+                       chunk.instances.size() * sizeof(glyph_instance_s));
+
+            if (!chunk.attrs.empty())
+                memcpy(&m_TextAttribs[chunk.attr_offset], &chunk.attrs[0],
+                       chunk.attrs.size() * sizeof(text_attr_s));
+        });
+
+    if (used > 0)
+        pen = m_Chunks[used - 1].pen;
+
+    return true;
+}
+
+bool TextLayoutImpl::LayoutRun(layout_cursor_s & cursor,
+                               const style_s & style,
+                               const wchar_t * text,
+                               size_t length) const {
+    cursor.segment_x = cursor.pen.x;
+
+    for(size_t i=0;i < length; i++) {
+        if (!LayoutChar(cursor, style, text[i])) {
+            return false;
+        }
+    }
+
+    if (cursor.pen.x != cursor.segment_x)
+        AddTextAttr(cursor, style);
+
+    return true;
+}
+
+bool TextLayoutImpl::LayoutChar(layout_cursor_s & cursor,
+                                const style_s & style,
+                                wchar_t ch) const {
+    auto & pen = cursor.pen;
+
+    if (ch == L'\n') {
+        if (pen.x != cursor.segment_x)
+            AddTextAttr(cursor, style);
+
+        pen.y -= style.adv_y;
+        pen.x = cursor.segment_x = cursor.origin_x;
+        return true;
+    }
+
+    const auto & glyphs = *style.glyphs;
+    auto id = glyphs.Find(ch);
+
+    if (id == INVALID_GLYPH_ID) {
+        if (!cursor.load_glyphs)
+            return true;
+
+        id = style.font->LoadGlyphId(ch);
+
+        if (id == INVALID_GLYPH_ID)
+            return true;
+    }
+
+    auto glyph_adv_x = glyphs.AdvanceX(id);
+    auto adv_x = m_Viewport.glyph_width ? (char_width(ch) > 1 ? m_Viewport.glyph_width * 2 : m_Viewport.glyph_width) : glyph_adv_x;
+
+    if (!glyphs.NeedDraw(id)) {
+        pen.x += adv_x;
+        return true;
+    }
+
+    if (style.font_slot >= MAX_FONT_SLOTS || id > GLYPH_ID_MASK) {
+        std::cerr << "too many fonts or glyphs in text layout" << std::endl;
+        return false;
+    }
+
+    cursor.instances->push_back({
+            (style.font_slot << GLYPH_ID_BITS) | id,
+            static_cast<float>(pen.x),
+            static_cast<float>(pen.y - style.ascender)
+        });
+
+    pen.x += adv_x;
+
+    //TOOD: kerning
+    return true;
+}
+
+void TextLayoutImpl::Clear() {
+    m_TextAttribs.clear();
+    m_ForeAttribs.clear();
+    m_BackAttribs.clear();
+    m_Instances.clear();
+
+    m_Finished = true;
+}
+
+static
+bool is_same_color(const float (&a)[4], const float (&b)[4]) {
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && a[3] == b[3];
+}
+
+//b continues a on the same line
+static
+bool is_adjacent(const text_attr_s & a, const text_attr_s & b) {
+    return a.bounds[2] == b.bounds[0]
+            && a.bounds[1] == b.bounds[1]
+            && a.bounds[3] == b.bounds[3];
+}
+
+void TextLayoutImpl::CompactAttrs() {
+    m_ForeAttribs.clear();
+    m_BackAttribs.clear();
+
+    for(const auto & attr : m_TextAttribs) {
+        if (!m_ForeAttribs.empty()
+            && is_adjacent(m_ForeAttribs.back(), attr)
+            && is_same_color(m_ForeAttribs.back().color, attr.color)) {
+            m_ForeAttribs.back().bounds[2] = attr.bounds[2];
+        } else {
+            m_ForeAttribs.push_back(attr);
+        }
+
+        if (attr.back_color[3] == 0)
+            continue;
+
+        if (!m_BackAttribs.empty()
+            && is_adjacent(m_BackAttribs.back(), attr)
+            && is_same_color(m_BackAttribs.back().back_color, attr.back_color)) {
+            m_BackAttribs.back().bounds[2] = attr.bounds[2];
+        } else {
+            m_BackAttribs.push_back(attr);
+        }
+    }
+}
+
+void TextLayoutImpl::Finish() {
+    if (m_Finished)
+        return;
+
+    CompactAttrs();
+    radix_sort_instances(m_Instances, m_SortScratch);
+
+    m_Finished = true;
+}
+
+} //namespace impl
+
+TextLayoutPtr CreateTextLayout(const viewport::viewport_s & viewport) {
+    return std::make_shared<impl::TextLayoutImpl>(viewport);
+}
+
+} //namespace text
+} //namespace ftdgl
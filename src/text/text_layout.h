@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include "pen.h"
+#include "markup.h"
+#include "viewport.h"
+
+namespace ftdgl {
+namespace text {
+
+typedef struct  __text_attr_s {
+    float bounds[4];
+    float color[4];
+    float back_color[4];
+} text_attr_s;
+
+//a run of text drawn with a style registered by AddStyle
+typedef struct __text_run_s {
+    uint32_t style_id;
+    const wchar_t * text;
+    size_t length;
+} text_run_s;
+
+//glyph key is the font slot of the layout in the upper bits
+//and the glyph id of that font in the lower bits
+constexpr uint32_t GLYPH_ID_BITS = 21;
+constexpr uint32_t GLYPH_ID_MASK = (1 << GLYPH_ID_BITS) - 1;
+constexpr uint32_t MAX_FONT_SLOTS = 1 << (32 - GLYPH_ID_BITS);
+
+//one per drawn char, x and y is the glyph origin in viewport pixels
+typedef struct __glyph_instance_s {
+    uint32_t key;
+    float x;
+    float y;
+} glyph_instance_s;
+
+//glyph instances and attr rects of laid out text, no GL calls, so it can
+//be filled on any thread and handed to TextBuffer::Commit on the GL thread
+class TextLayout {
+public:
+    TextLayout() = default;
+    virtual ~TextLayout() = default;
+
+public:
+    virtual bool AddText(pen_s & pen, const markup_s & markup, const std::wstring & text) = 0;
+    //register a markup once and get a small id for AddRuns,
+    //equal markups share the same id, styles survive Clear()
+    virtual uint32_t AddStyle(const markup_s & markup) = 0;
+    //lay out runs in order, a new line returns to pen.x at the call
+    virtual bool AddRuns(pen_s & pen, const text_run_s * runs, size_t count) = 0;
+    //lay out large AddText calls on count threads split at line
+    //boundaries, 0 means one per hardware thread, 1 disables it
+    virtual void SetLayoutThreads(size_t count) = 0;
+    virtual void Clear() = 0;
+    //sort the instances by glyph and compact the attr rects, Commit
+    //calls it when needed, call it on the worker to keep Commit cheap
+    virtual void Finish() = 0;
+
+    //the getters below are valid after Finish
+    virtual uint32_t GetGlyphInstanceCount() const = 0;
+    virtual const glyph_instance_s * GetGlyphInstances() const = 0;
+    //font of a font slot in the glyph keys
+    virtual uint32_t GetFontCount() const = 0;
+    virtual const FontPtr & GetFont(uint32_t slot) const = 0;
+    //rects for the foreground pass, adjacent rects of a line with the
+    //same fore color are merged
+    virtual uint32_t GetTextAttrCount() const = 0;
+    virtual const text_attr_s * GetTextAttr() const = 0;
+    //rects for the background pass, transparent backgrounds dropped and
+    //adjacent rects of a line with the same back color merged
+    virtual uint32_t GetBackgroundAttrCount() const = 0;
+    virtual const text_attr_s * GetBackgroundAttr() const = 0;
+};
+
+using TextLayoutPtr = std::shared_ptr<TextLayout>;
+
+TextLayoutPtr CreateTextLayout(const viewport::viewport_s & viewport);
+
+} //namespace text
+} //namespace ftdgl
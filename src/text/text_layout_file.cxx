@@ -0,0 +1,376 @@
+#include "text_layout_file.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+namespace ftdgl {
+namespace text {
+namespace impl {
+
+static
+const
+char LAYOUT_FILE_MAGIC[4] = {'F', 'D', 'G', 'L'};
+
+constexpr uint32_t LAYOUT_FILE_VERSION = 1;
+
+//sections follow the header at 4 byte aligned offsets from the start
+//of the file, integers and floats in the byte order of the writer
+typedef struct __layout_file_header_s {
+    char magic[4];
+    uint32_t version;
+    uint32_t file_size;
+    uint32_t viewport_width;
+    uint32_t viewport_height;
+    uint32_t font_count;
+    uint32_t glyph_count;
+    uint32_t instance_count;
+    uint32_t fore_count;
+    uint32_t back_count;
+    uint32_t font_offset;
+    uint32_t glyph_offset;
+    uint32_t instance_offset;
+    uint32_t fore_offset;
+    uint32_t back_offset;
+    uint32_t string_offset;
+} layout_file_header_s;
+
+//a font slot of the glyph keys, the glyph id part of a key is an index
+//into the codepoints of the slot in the glyph section
+typedef struct __layout_file_font_s {
+    uint32_t desc_offset;
+    uint32_t desc_length;
+    uint32_t first_glyph;
+    uint32_t glyph_count;
+} layout_file_font_s;
+
+using glyph_instance_vector = std::vector<glyph_instance_s>;
+using font_vector = std::vector<FontPtr>;
+
+//a layout file mapped read only, instances point into the mapping
+//unless the glyph ids had to be translated
+class MappedTextLayoutImpl : public TextLayout {
+public:
+    MappedTextLayoutImpl()
+        : m_File {}
+        , m_Region {}
+        , m_Fonts {}
+        , m_Remapped {}
+        , m_Instances {nullptr}
+        , m_ForeAttribs {nullptr}
+        , m_BackAttribs {nullptr}
+        , m_InstanceCount {0}
+        , m_ForeCount {0}
+        , m_BackCount {0} {
+    }
+
+    virtual ~MappedTextLayoutImpl() = default;
+
+public:
+    virtual bool AddText(pen_s &, const markup_s &, const std::wstring &) {
+        std::cerr << "a loaded text layout is read only" << std::endl;
+        return false;
+    }
+
+    virtual uint32_t AddStyle(const markup_s &) {
+        std::cerr << "a loaded text layout is read only" << std::endl;
+        return 0;
+    }
+
+    virtual bool AddRuns(pen_s &, const text_run_s *, size_t) {
+        std::cerr << "a loaded text layout is read only" << std::endl;
+        return false;
+    }
+
+    virtual void SetLayoutThreads(size_t) {}
+
+    virtual void Clear() {
+        m_InstanceCount = m_ForeCount = m_BackCount = 0;
+    }
+
+    virtual void Finish() {}
+
+    virtual uint32_t GetGlyphInstanceCount() const { return m_InstanceCount; }
+    virtual const glyph_instance_s * GetGlyphInstances() const { return m_Instances; }
+    virtual uint32_t GetFontCount() const { return m_Fonts.size(); }
+    virtual const FontPtr & GetFont(uint32_t slot) const { return m_Fonts[slot]; }
+    virtual uint32_t GetTextAttrCount() const { return m_ForeCount; }
+    virtual const text_attr_s * GetTextAttr() const { return m_ForeAttribs; }
+    virtual uint32_t GetBackgroundAttrCount() const { return m_BackCount; }
+    virtual const text_attr_s * GetBackgroundAttr() const { return m_BackAttribs; }
+
+    bool Load(const std::string & path,
+              const viewport::viewport_s & viewport,
+              FontManagerPtr font_manager);
+
+private:
+    boost::interprocess::file_mapping m_File;
+    boost::interprocess::mapped_region m_Region;
+
+    font_vector m_Fonts;
+    //instances with the glyph ids of the fonts of this process
+    glyph_instance_vector m_Remapped;
+
+    const glyph_instance_s * m_Instances;
+    const text_attr_s * m_ForeAttribs;
+    const text_attr_s * m_BackAttribs;
+    uint32_t m_InstanceCount;
+    uint32_t m_ForeCount;
+    uint32_t m_BackCount;
+};
+
+//count items of size bytes at offset fit in the file
+static
+bool section_fits(uint32_t offset, uint32_t count, size_t size, size_t file_size) {
+    return offset % 4 == 0
+            && offset <= file_size
+            && count <= (file_size - offset) / size;
+}
+
+bool MappedTextLayoutImpl::Load(const std::string & path,
+                                const viewport::viewport_s & viewport,
+                                FontManagerPtr font_manager) {
+    try {
+        m_File = boost::interprocess::file_mapping(path.c_str(), boost::interprocess::read_only);
+        m_Region = boost::interprocess::mapped_region(m_File, boost::interprocess::read_only);
+    } catch (const boost::interprocess::interprocess_exception & e) {
+        std::cerr << "could not map text layout file " << path << ":" << e.what() << std::endl;
+        return false;
+    }
+
+    const uint8_t * data = static_cast<const uint8_t *>(m_Region.get_address());
+    size_t size = m_Region.get_size();
+
+    if (size < sizeof(layout_file_header_s)) {
+        std::cerr << "text layout file " << path << " is too short" << std::endl;
+        return false;
+    }
+
+    layout_file_header_s header;
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, LAYOUT_FILE_MAGIC, sizeof(header.magic))
+        || header.version != LAYOUT_FILE_VERSION
+        || header.file_size != size
+        || header.font_count > MAX_FONT_SLOTS
+        || !section_fits(header.font_offset, header.font_count, sizeof(layout_file_font_s), size)
+        || !section_fits(header.glyph_offset, header.glyph_count, sizeof(uint32_t), size)
+        || !section_fits(header.instance_offset, header.instance_count, sizeof(glyph_instance_s), size)
+        || !section_fits(header.fore_offset, header.fore_count, sizeof(text_attr_s), size)
+        || !section_fits(header.back_offset, header.back_count, sizeof(text_attr_s), size)
+        || header.string_offset > size) {
+        std::cerr << "text layout file " << path << " is not valid" << std::endl;
+        return false;
+    }
+
+    //rects are relative to the viewport, instances in its pixels
+    if (header.viewport_width != static_cast<uint32_t>(viewport.width)
+        || header.viewport_height != static_cast<uint32_t>(viewport.height)) {
+        std::cerr << "text layout file " << path << " is for a "
+                  << header.viewport_width << "x" << header.viewport_height << " viewport" << std::endl;
+        return false;
+    }
+
+    const layout_file_font_s * fonts =
+            reinterpret_cast<const layout_file_font_s *>(data + header.font_offset);
+    const uint32_t * codepoints = reinterpret_cast<const uint32_t *>(data + header.glyph_offset);
+    const char * strings = reinterpret_cast<const char *>(data + header.string_offset);
+    size_t string_size = size - header.string_offset;
+
+    //glyph ids in this process, the file ids stay valid when a font
+    //loads the glyphs in the same order it did for the writer
+    std::vector<uint32_t> glyph_ids(header.glyph_count);
+    bool same_ids = true;
+
+    for(uint32_t f = 0; f < header.font_count; f++) {
+        const auto & font_entry = fonts[f];
+
+        if (font_entry.desc_offset > string_size
+            || font_entry.desc_length > string_size - font_entry.desc_offset
+            || font_entry.first_glyph > header.glyph_count
+            || font_entry.glyph_count > header.glyph_count - font_entry.first_glyph) {
+            std::cerr << "text layout file " << path << " is not valid" << std::endl;
+            return false;
+        }
+
+        std::string desc(strings + font_entry.desc_offset, font_entry.desc_length);
+        auto font = font_manager->CreateFontFromDesc(desc);
+
+        if (!font)
+            return false;
+
+        for(uint32_t g = 0; g < font_entry.glyph_count; g++) {
+            auto id = font->LoadGlyphId(codepoints[font_entry.first_glyph + g]);
+
+            if (id == INVALID_GLYPH_ID) {
+                std::cerr << "could not load glyph " << codepoints[font_entry.first_glyph + g]
+                          << " of " << desc << std::endl;
+                return false;
+            }
+
+            glyph_ids[font_entry.first_glyph + g] = id;
+            same_ids = same_ids && id == g;
+        }
+
+        m_Fonts.push_back(font);
+    }
+
+    const glyph_instance_s * instances =
+            reinterpret_cast<const glyph_instance_s *>(data + header.instance_offset);
+
+    for(uint32_t i = 0; i < header.instance_count; i++) {
+        auto slot = instances[i].key >> GLYPH_ID_BITS;
+
+        if (slot >= header.font_count || (instances[i].key & GLYPH_ID_MASK) >= fonts[slot].glyph_count) {
+            std::cerr << "text layout file " << path << " is not valid" << std::endl;
+            return false;
+        }
+    }
+
+    if (same_ids) {
+        m_Instances = instances;
+    } else {
+        m_Remapped.assign(instances, instances + header.instance_count);
+
+        //keys stay grouped, equal keys map to equal keys
+        for(auto & instance : m_Remapped) {
+            auto slot = instance.key >> GLYPH_ID_BITS;
+            auto id = glyph_ids[fonts[slot].first_glyph + (instance.key & GLYPH_ID_MASK)];
+
+            instance.key = (slot << GLYPH_ID_BITS) | id;
+        }
+
+        m_Instances = m_Remapped.data();
+    }
+
+    m_ForeAttribs = reinterpret_cast<const text_attr_s *>(data + header.fore_offset);
+    m_BackAttribs = reinterpret_cast<const text_attr_s *>(data + header.back_offset);
+    m_InstanceCount = header.instance_count;
+    m_ForeCount = header.fore_count;
+    m_BackCount = header.back_count;
+    return true;
+}
+
+static
+uint32_t align4(size_t v) {
+    return static_cast<uint32_t>((v + 3) / 4 * 4);
+}
+
+} //namespace impl
+
+bool SaveTextLayout(TextLayoutPtr layout,
+                    const viewport::viewport_s & viewport,
+                    const std::string & path) {
+    layout->Finish();
+
+    const glyph_instance_s * instances = layout->GetGlyphInstances();
+    uint32_t instance_count = layout->GetGlyphInstanceCount();
+    uint32_t font_count = layout->GetFontCount();
+
+    //the glyph ids each font slot uses, ascending, the file refers to
+    //them by index so it does not depend on the glyph table of the writer
+    std::vector<std::vector<uint32_t>> used(font_count);
+
+    for(uint32_t i = 0; i < instance_count; i++) {
+        auto & ids = used[instances[i].key >> GLYPH_ID_BITS];
+        auto id = instances[i].key & GLYPH_ID_MASK;
+
+        //instances are sorted by key
+        if (ids.empty() || ids.back() != id)
+            ids.push_back(id);
+    }
+
+    std::vector<impl::layout_file_font_s> fonts(font_count);
+    std::vector<uint32_t> codepoints;
+    std::string strings;
+
+    for(uint32_t f = 0; f < font_count; f++) {
+        const auto & font = layout->GetFont(f);
+        const auto & glyphs = font->GetGlyphTable();
+
+        fonts[f] = {static_cast<uint32_t>(strings.size()),
+                    static_cast<uint32_t>(font->GetDesc().size()),
+                    static_cast<uint32_t>(codepoints.size()),
+                    static_cast<uint32_t>(used[f].size())};
+
+        strings += font->GetDesc();
+
+        for(auto id : used[f])
+            codepoints.push_back(glyphs.Codepoint(id));
+    }
+
+    std::vector<glyph_instance_s> indexed(instances, instances + instance_count);
+
+    for(auto & instance : indexed) {
+        auto slot = instance.key >> GLYPH_ID_BITS;
+        const auto & ids = used[slot];
+        auto index = std::lower_bound(ids.begin(), ids.end(), instance.key & GLYPH_ID_MASK) - ids.begin();
+
+        instance.key = (slot << GLYPH_ID_BITS) | static_cast<uint32_t>(index);
+    }
+
+    impl::layout_file_header_s header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, impl::LAYOUT_FILE_MAGIC, sizeof(header.magic));
+
+    header.version = impl::LAYOUT_FILE_VERSION;
+    header.viewport_width = viewport.width;
+    header.viewport_height = viewport.height;
+    header.font_count = font_count;
+    header.glyph_count = codepoints.size();
+    header.instance_count = instance_count;
+    header.fore_count = layout->GetTextAttrCount();
+    header.back_count = layout->GetBackgroundAttrCount();
+    header.font_offset = impl::align4(sizeof(header));
+    header.glyph_offset = header.font_offset + font_count * sizeof(impl::layout_file_font_s);
+    header.instance_offset = header.glyph_offset + header.glyph_count * sizeof(uint32_t);
+    header.fore_offset = header.instance_offset + instance_count * sizeof(glyph_instance_s);
+    header.back_offset = header.fore_offset + header.fore_count * sizeof(text_attr_s);
+    header.string_offset = header.back_offset + header.back_count * sizeof(text_attr_s);
+    header.file_size = header.string_offset + impl::align4(strings.size());
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    if (!file) {
+        std::cerr << "could not create text layout file " << path << std::endl;
+        return false;
+    }
+
+    static const char padding[4] = {0, 0, 0, 0};
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(padding, header.font_offset - sizeof(header));
+    file.write(reinterpret_cast<const char *>(fonts.data()), fonts.size() * sizeof(fonts[0]));
+    file.write(reinterpret_cast<const char *>(codepoints.data()), codepoints.size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char *>(indexed.data()), indexed.size() * sizeof(glyph_instance_s));
+    file.write(reinterpret_cast<const char *>(layout->GetTextAttr()), header.fore_count * sizeof(text_attr_s));
+    file.write(reinterpret_cast<const char *>(layout->GetBackgroundAttr()), header.back_count * sizeof(text_attr_s));
+    file.write(strings.data(), strings.size());
+    file.write(padding, header.file_size - header.string_offset - strings.size());
+
+    if (!file) {
+        std::cerr << "could not write text layout file " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+TextLayoutPtr LoadTextLayout(const std::string & path,
+                             const viewport::viewport_s & viewport,
+                             FontManagerPtr font_manager) {
+    auto layout = std::make_shared<impl::MappedTextLayoutImpl>();
+
+    if (!layout->Load(path, viewport, font_manager))
+        return TextLayoutPtr {};
+
+    return layout;
+}
+
+} //namespace text
+} //namespace ftdgl
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+#include "font_manager.h"
+#include "text_layout.h"
+
+namespace ftdgl {
+namespace text {
+
+//write the font descriptions, the codepoints of the used glyphs, the
+//glyph instances and the rects of layout to path, calls Finish first,
+//viewport is the one the layout was created with
+bool SaveTextLayout(TextLayoutPtr layout,
+                    const viewport::viewport_s & viewport,
+                    const std::string & path);
+//map a file written by SaveTextLayout without laying the text out again,
+//fonts are created from their descriptions, file fonts from their path,
+//memory fonts have to be created with CreateFontFromMemory before loading,
+//the instances are used in place when the glyph ids did not change, the
+//layout is read only and is meant for TextBuffer::Commit, empty when the
+//file is not valid or was written for a viewport of another size
+TextLayoutPtr LoadTextLayout(const std::string & path,
+                             const viewport::viewport_s & viewport,
+                             FontManagerPtr font_manager);
+
+} //namespace text
+} //namespace ftdgl
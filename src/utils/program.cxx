@@ -7,7 +7,16 @@ ProgramPtr CreateProgram(const char * vert_source, const char * frag_source, uin
     return {new GLuint[1] {shader_load(vert_source, frag_source, attrib_map_count, attrib_map)},
             [] (auto p) {
                 glDeleteProgram(p[0]);
-                delete p;
+                delete [] p;
+            }
+    };
+}
+
+ProgramPtr CreateComputeProgram(const char * source) {
+    return {new GLuint[1] {shader_load_compute(source)},
+            [] (auto p) {
+                glDeleteProgram(p[0]);
+                delete [] p;
             }
     };
 }
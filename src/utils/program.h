@@ -7,8 +7,18 @@
 namespace ftdgl {
 using ProgramPtr = std::shared_ptr<GLuint>;
 
-ProgramPtr CreateTextBufferProgram();
-ProgramPtr CreateRenderProgram();
+//variants are built once per sample count
+ProgramPtr CreateTextBufferProgram(uint32_t samples);
+//gray_samples 0 composites the 6x lcd texture, other counts a gray
+//texture with that many samples, front faces in red and back in green
+ProgramPtr CreateRenderProgram(uint32_t gray_samples);
+//needs dual source blending, GL_MAX_DUAL_SOURCE_DRAW_BUFFERS > 0
+ProgramPtr CreateRenderDualSourceProgram(uint32_t gray_samples);
 ProgramPtr CreateRenderBackgroundProgram();
+//the background program reading the fore color
+ProgramPtr CreateRenderCoverProgram();
+//compute raster variants, gray writes an rg8 image instead of rgba8
+ProgramPtr CreateComputeRasterProgram(uint32_t samples, bool gray);
+ProgramPtr CreateComputeProgram(const char * source);
 ProgramPtr CreateProgram(const char * vert_source, const char * frag_source, uint32_t attrib_map_count = 0, attrib_map_s * attrib_map = nullptr);
 } //namespace ftdgl
@@ -0,0 +1,109 @@
+#include "program.h"
+
+#include <map>
+#include <string>
+
+namespace ftdgl {
+namespace impl {
+//one variant per jitter sample count and image format
+static
+std::map<uint32_t, ProgramPtr> g_ComputeRasterPrograms = {};
+
+//SAMPLES, TILE_SIZE and IMAGE_FORMAT are defined by CreateComputeRasterProgram
+static
+const char * compute_source = "\n"
+        "layout(local_size_x=TILE_SIZE, local_size_y=TILE_SIZE) in;\n"
+        "struct entry_s {\n"
+        "	int first_vertex;\n"
+        "	int vertex_count;\n"
+        "	vec2 offset;\n"
+        "};\n"
+        "layout(std430, binding=0) readonly buffer geometry_buffer { vec4 vertices[]; };\n"
+        "layout(std430, binding=1) readonly buffer entry_buffer { entry_s entries[]; };\n"
+        "layout(std430, binding=2) readonly buffer tile_buffer { uvec2 tiles[]; };\n"
+        "layout(binding=0, IMAGE_FORMAT) writeonly uniform image2D target;\n"
+        "uniform ivec2 target_origin;\n"
+        "uniform ivec2 target_size;\n"
+        "uniform int tile_columns;\n"
+        "uniform vec2 jitter[SAMPLES];\n"
+        "uniform vec4 front[SAMPLES];\n"
+        "uniform vec4 back[SAMPLES];\n"
+        "float edge(vec2 a, vec2 b, vec2 p) {\n"
+        "	return (b.x - a.x) * (p.y - a.y) - (p.x - a.x) * (b.y - a.y);\n"
+        "}\n"
+        "// samples on an edge count for one of the two triangles sharing it\n"
+        "bool inside(float w, vec2 direction) {\n"
+        "	return w > 0.0 || (w == 0.0 && (direction.y < 0.0 || (direction.y == 0.0 && direction.x > 0.0)));\n"
+        "}\n"
+        "void main() {\n"
+        "	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);\n"
+        "	if (any(greaterThanEqual(pixel, target_size))) {\n"
+        "		return;\n"
+        "	}\n"
+        "\n"
+        "	uvec2 tile = tiles[gl_WorkGroupID.y * uint(tile_columns) + gl_WorkGroupID.x];\n"
+        "	vec2 center = vec2(pixel) + 0.5;\n"
+        "	vec4 sum = vec4(0.0);\n"
+        "\n"
+        "	for (uint e = tile.x; e < tile.x + tile.y; e++) {\n"
+        "		entry_s entry = entries[e];\n"
+        "\n"
+        "		for (int v = entry.first_vertex; v < entry.first_vertex + entry.vertex_count; v += 3) {\n"
+        "			vec4 v0 = vertices[v];\n"
+        "			vec4 v1 = vertices[v + 1];\n"
+        "			vec4 v2 = vertices[v + 2];\n"
+        "			vec2 p0 = v0.xy + entry.offset;\n"
+        "			vec2 p1 = v1.xy + entry.offset;\n"
+        "			vec2 p2 = v2.xy + entry.offset;\n"
+        "			float area = edge(p0, p1, p2);\n"
+        "			if (area == 0.0) {\n"
+        "				continue;\n"
+        "			}\n"
+        "\n"
+        "			bool front_facing = area > 0.0;\n"
+        "			float side = sign(area);\n"
+        "\n"
+        "			for (int s = 0; s < SAMPLES; s++) {\n"
+        "				// the raster path moves the glyph by half the jitter\n"
+        "				vec2 p = center - jitter[s] * 0.5;\n"
+        "				float w0 = edge(p1, p2, p);\n"
+        "				float w1 = edge(p2, p0, p);\n"
+        "				float w2 = edge(p0, p1, p);\n"
+        "				if (!inside(w0 * side, (p2 - p1) * side)\n"
+        "					|| !inside(w1 * side, (p0 - p2) * side)\n"
+        "					|| !inside(w2 * side, (p1 - p0) * side)) {\n"
+        "					continue;\n"
+        "				}\n"
+        "\n"
+        "				vec2 coord = (w0 * v0.zw + w1 * v1.zw + w2 * v2.zw) / area;\n"
+        "				if (coord.x * coord.x - coord.y > 0.0) {\n"
+        "					continue;\n"
+        "				}\n"
+        "\n"
+        "				sum += front_facing ? front[s] : back[s];\n"
+        "			}\n"
+        "		}\n"
+        "	}\n"
+        "\n"
+        "	imageStore(target, pixel + target_origin, min(sum, vec4(255.0)) / 255.0);\n"
+        "}\n";
+
+} //namespace impl
+
+ProgramPtr CreateComputeRasterProgram(uint32_t samples, bool gray) {
+    auto & program = impl::g_ComputeRasterPrograms[samples * 2 + (gray ? 1 : 0)];
+
+    if (!program) {
+        std::string source = "#version 430 core\n"
+                "#define SAMPLES " + std::to_string(samples) + "\n"
+                "#define TILE_SIZE 16\n"
+                "#define IMAGE_FORMAT " + (gray ? "rg8" : "rgba8") + "\n";
+        source += impl::compute_source;
+
+        program = CreateComputeProgram(source.c_str());
+    }
+
+    return program;
+}
+
+} //namespace ftdgl
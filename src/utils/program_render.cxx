@@ -1,9 +1,15 @@
 #include "program.h"
 
+#include <map>
+#include <string>
+
 namespace ftdgl {
 namespace impl {
+//one variant per gray sample count, 0 is the lcd variant
+static
+std::map<uint32_t, ProgramPtr> g_RenderPrograms = {};
 static
-ProgramPtr g_RenderProgram = {};
+std::map<uint32_t, ProgramPtr> g_RenderDualSourcePrograms = {};
 
 static
 const char * vert_source = "\n"
@@ -11,61 +17,115 @@ const char * vert_source = "\n"
         "layout(location=0) in vec2 position2;\n"
         "layout(location=1) in vec4 rect;\n"
         "layout(location=3) in vec4 color;\n"
+        "layout(location=4) in vec4 texture_rect;\n"
+        "uniform mat3 transform;\n"
         "out vec2 _coord2;\n"
         "out vec4 _color;\n"
         "void main() {\n"
-        "	_coord2 = mix(rect.xy, rect.zw, position2 * 0.5 + 0.5);\n"
+        "	vec2 pos = mix(rect.xy, rect.zw, position2 * 0.5 + 0.5);\n"
+        "	// the texture only covers texture_rect of the viewport\n"
+        "	_coord2 = (pos - texture_rect.xy) / (texture_rect.zw - texture_rect.xy);\n"
         "   _color = color;\n"
-        "	gl_Position = vec4(_coord2 * 2.0 - 1.0, 0.0, 1.0);\n"
+        "	// transform works in clip space, so the identity keeps pos exact\n"
+        "	gl_Position = vec4((transform * vec3(pos * 2.0 - 1.0, 1.0)).xy, 0.0, 1.0);\n"
         "}\n";
 
+//coverage of the three sub pixels from the accumulation texture, gray
+//variants count GRAY_SAMPLES samples for all three, front faces in red
+//and back faces in green
+#define COVERAGE_SOURCE \
+        "uniform sampler2D texture_render;\n" \
+        "in vec2 _coord2;\n" \
+        "vec4 coverage() {\n" \
+        "#if GRAY_SAMPLES > 0\n" \
+        "	vec2 count = floor(texture(texture_render, _coord2).xy * 255.0 + 0.5);\n" \
+        "	float alpha = min(abs(count.x - count.y), float(GRAY_SAMPLES)) / float(GRAY_SAMPLES);\n" \
+        "	return vec4(alpha, alpha, alpha, 0.0);\n" \
+        "#else\n" \
+        "	// Get samples for -2/3 and -1/3\n" \
+        "	vec2 valueL = texture(texture_render, vec2(_coord2.x + dFdx(_coord2.x), _coord2.y)).yz * 255.0;\n" \
+        "	vec2 lowerL = mod(valueL, 16.0);\n" \
+        "	vec2 upperL = (valueL - lowerL) / 16.0;\n" \
+        "	vec2 alphaL = min(abs(upperL - lowerL), 2.0);\n" \
+        "\n" \
+        "	// Get samples for 0, +1/3, and +2/3\n" \
+        "	vec3 valueR = texture(texture_render, _coord2).xyz * 255.0;\n" \
+        "	vec3 lowerR = mod(valueR, 16.0);\n" \
+        "	vec3 upperR = (valueR - lowerR) / 16.0;\n" \
+        "	vec3 alphaR = min(abs(upperR - lowerR), 2.0);\n" \
+        "\n" \
+        "	// Average the energy over the pixels on either side\n" \
+        "	return vec4(\n" \
+        "		(alphaR.x + alphaR.y + alphaR.z) / 6.0,\n" \
+        "		(alphaL.y + alphaR.x + alphaR.y) / 6.0,\n" \
+        "		(alphaL.x + alphaL.y + alphaR.x) / 6.0,\n" \
+        "		0.0);\n" \
+        "#endif\n" \
+        "}\n"
+
+//GRAY_SAMPLES is defined by CreateProgramVariant
 static
 const char * frag_source = "\n"
-        "#version 330 core\n"
-        "uniform sampler2D texture_render;\n"
+        COVERAGE_SOURCE
         "uniform float first_round;\n"
-        "in vec2 _coord2;\n"
         "in vec4 _color;\n"
         "out vec4 output_color;\n"
         "void main() {\n"
-        "	// Get samples for -2/3 and -1/3\n"
-        "	vec2 valueL = texture(texture_render, vec2(_coord2.x + dFdx(_coord2.x), _coord2.y)).yz * 255.0;\n"
-        "	vec2 lowerL = mod(valueL, 16.0);\n"
-        "	vec2 upperL = (valueL - lowerL) / 16.0;\n"
-        "	vec2 alphaL = min(abs(upperL - lowerL), 2.0);\n"
-        "\n"
-        "	// Get samples for 0, +1/3, and +2/3\n"
-        "	vec3 valueR = texture(texture_render, _coord2).xyz * 255.0;\n"
-        "	vec3 lowerR = mod(valueR, 16.0);\n"
-        "	vec3 upperR = (valueR - lowerR) / 16.0;\n"
-        "	vec3 alphaR = min(abs(upperR - lowerR), 2.0);\n"
-        "\n"
-        "	// Average the energy over the pixels on either side\n"
-        "	vec4 rgba = vec4(\n"
-        "		(alphaR.x + alphaR.y + alphaR.z) / 6.0,\n"
-        "		(alphaL.y + alphaR.x + alphaR.y) / 6.0,\n"
-        "		(alphaL.x + alphaL.y + alphaR.x) / 6.0,\n"
-        "		0.0);\n"
+        "	vec4 rgba = coverage();\n"
         "\n"
         "	// Optionally scale by a color\n"
         "	output_color = first_round == 1.0 ? 1.0 - rgba : _color * rgba;\n"
         "}\n";
 
+//the second output is the per channel coverage the blend scales the
+//destination by, so one pass does the work of both rounds above
+static
+const char * dual_source_frag_source = "\n"
+        COVERAGE_SOURCE
+        "in vec4 _color;\n"
+        "layout(location=0, index=0) out vec4 output_color;\n"
+        "layout(location=0, index=1) out vec4 output_coverage;\n"
+        "void main() {\n"
+        "	vec4 rgba = coverage();\n"
+        "\n"
+        "	output_color = _color * rgba;\n"
+        "	output_coverage = rgba;\n"
+        "}\n";
+
+static
+ProgramPtr CreateProgramVariant(const char * frag_source, uint32_t gray_samples) {
+    attrib_map_s map[] = {
+        {4, "texture_rect"},
+        {3, "color"},
+        {1, "rect"},
+        {0, "position2"},
+    };
+
+    std::string source = "#version 330 core\n"
+            "#define GRAY_SAMPLES " + std::to_string(gray_samples) + "\n";
+    source += frag_source;
+
+    return CreateProgram(vert_source, source.c_str(), sizeof(map) / sizeof(attrib_map_s), map);
+}
 
 } //namespace impl
 
-ProgramPtr CreateRenderProgram() {
-    if (!impl::g_RenderProgram) {
-        attrib_map_s map[] = {
-            {3, "color"},
-            {1, "rect"},
-            {0, "position2"},
-        };
+ProgramPtr CreateRenderProgram(uint32_t gray_samples) {
+    auto & program = impl::g_RenderPrograms[gray_samples];
+
+    if (!program)
+        program = impl::CreateProgramVariant(impl::frag_source, gray_samples);
+
+    return program;
+}
+
+ProgramPtr CreateRenderDualSourceProgram(uint32_t gray_samples) {
+    auto & program = impl::g_RenderDualSourcePrograms[gray_samples];
 
-        impl::g_RenderProgram = CreateProgram(impl::vert_source, impl::frag_source, sizeof(map) / sizeof(attrib_map_s), map);
-    }
+    if (!program)
+        program = impl::CreateProgramVariant(impl::dual_source_frag_source, gray_samples);
 
-    return impl::g_RenderProgram;
+    return program;
 }
 
 } //namespace ftdgl
@@ -4,19 +4,24 @@ namespace ftdgl {
 namespace impl {
 static
 ProgramPtr g_RenderBackgroundProgram = {};
+static
+ProgramPtr g_RenderCoverProgram = {};
 
+//color is bound by the attrib map, back color for the background and
+//fore color for the cover quads of the stencil mode
 static
 const char * vert_source = "\n"
         "#version 330 core\n"
         "layout(location=0) in vec2 position2;\n"
         "layout(location=1) in vec4 rect;\n"
-        "layout(location=2) in vec4 color;\n"
+        "in vec4 color;\n"
+        "uniform mat3 transform;\n"
         "out vec2 _coord2;\n"
         "out vec4 _color;\n"
         "void main() {\n"
         "	_coord2 = mix(rect.xy, rect.zw, position2 * 0.5 + 0.5);\n"
         "   _color = color;\n"
-        "	gl_Position = vec4(_coord2 * 2.0 - 1.0, 0.0, 1.0);\n"
+        "	gl_Position = vec4((transform * vec3(_coord2 * 2.0 - 1.0, 1.0)).xy, 0.0, 1.0);\n"
         "}\n";
 
 static
@@ -45,4 +50,17 @@ ProgramPtr CreateRenderBackgroundProgram() {
     return impl::g_RenderBackgroundProgram;
 }
 
+ProgramPtr CreateRenderCoverProgram() {
+    if (!impl::g_RenderCoverProgram) {
+        attrib_map_s map[] = {
+            {3, "color"},
+            {1, "rect"},
+            {0, "position2"},
+        };
+        impl::g_RenderCoverProgram = CreateProgram(impl::vert_source, impl::frag_source, sizeof(map) / sizeof(attrib_map_s), map);
+    }
+
+    return impl::g_RenderCoverProgram;
+}
+
 } //namespace ftdgl
@@ -1,28 +1,44 @@
 #include "program.h"
 
+#include <map>
+#include <string>
+
 namespace ftdgl {
 namespace impl {
+//one variant per jitter sample count
 static
-ProgramPtr g_TextBufferProgram = {};
+std::map<uint32_t, ProgramPtr> g_TextBufferPrograms = {};
 
+//SAMPLES is defined by CreateTextBufferProgram
 static
 const char * vert_source = "\n"
-        "#version 330 core\n"
         "layout(location=0) in vec4 position4;\n"
-        "layout(location=1) in vec4 color;\n"
-        "layout(location=2) in mat4 matrix4;\n"
+        "layout(location=1) in vec2 offset2;\n"
+        "uniform vec2 viewport;\n"
+        "uniform vec2 origin;\n"
+        "uniform vec2 jitter[SAMPLES];\n"
+        "uniform vec4 front[SAMPLES];\n"
+        "uniform vec4 back[SAMPLES];\n"
+        "uniform mat3 transform;\n"
         "out vec2 _coord2;\n"
-        "out vec4 _color;\n"
+        "out vec4 _front;\n"
+        "out vec4 _back;\n"
         "void main() {\n"
+        "	// every glyph instance is drawn once per jitter sample\n"
+        "	int jitter_index = gl_InstanceID % SAMPLES;\n"
         "	_coord2 = position4.zw;\n"
-        "   _color = color;\n"
-        "	gl_Position = matrix4 * vec4(position4.xy, 0.0, 1.0);\n"
+        "	_front = front[jitter_index];\n"
+        "	_back = back[jitter_index];\n"
+        "	// viewport is the texture size, origin its corner in the text viewport\n"
+        "	vec2 pos = (position4.xy + offset2 - origin) * 2.0 / viewport - 1.0 + jitter[jitter_index] / viewport;\n"
+        "	gl_Position = vec4((transform * vec3(pos, 1.0)).xy, 0.0, 1.0);\n"
         "}\n";
 
 static
 const char * frag_source = "\n"
         "#version 330 core\n"
-        "in vec4 _color;\n"
+        "in vec4 _front;\n"
+        "in vec4 _back;\n"
         "in vec2 _coord2;\n"
         "out vec4 output_color;\n"
         "void main() {\n"
@@ -30,24 +46,29 @@ const char * frag_source = "\n"
         "		discard;\n"
         "	}\n"
         "\n"
-        "	// Upper 4 bits: front faces\n"
-        "	// Lower 4 bits: back faces\n"
-        "	output_color = _color * (gl_FrontFacing ? 16.0 / 255.0 : 1.0 / 255.0);\n"
+        "	// front and back are the counts the sample adds per face\n"
+        "	output_color = (gl_FrontFacing ? _front : _back) / 255.0;\n"
         "}\n";
 
 } //namespace impl
 
-ProgramPtr CreateTextBufferProgram() {
-    if (!impl::g_TextBufferProgram) {
+ProgramPtr CreateTextBufferProgram(uint32_t samples) {
+    auto & program = impl::g_TextBufferPrograms[samples];
+
+    if (!program) {
         attrib_map_s map[] = {
-            {1, "color"},
-            {2, "matrix4"},
+            {1, "offset2"},
             {0, "position4"},
         };
-        impl::g_TextBufferProgram = CreateProgram(impl::vert_source, impl::frag_source, sizeof(map) / sizeof(attrib_map_s), map);
+
+        std::string vert_source = "#version 330 core\n"
+                "#define SAMPLES " + std::to_string(samples) + "\n";
+        vert_source += impl::vert_source;
+
+        program = CreateProgram(vert_source.c_str(), impl::frag_source, sizeof(map) / sizeof(attrib_map_s), map);
     }
 
-    return impl::g_TextBufferProgram;
+    return program;
 }
 
 } //namespace ftdgl
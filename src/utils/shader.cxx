@@ -59,4 +59,34 @@ shader_load(const char * vert_source, const char * frag_source, uint32_t attrib_
     return handle;
 }
 
+GLuint
+shader_load_compute(const char * source)
+{
+#ifndef GL_COMPUTE_SHADER
+    (void)source;
+    fprintf( stderr, "compute shaders are not supported\n" );
+    return 0;
+#else
+    GLuint handle = glCreateProgram( );
+    GLint link_status;
+
+    {
+        GLuint compute_shader = shader_compile( source, GL_COMPUTE_SHADER);
+        glAttachShader( handle, compute_shader);
+        glDeleteShader( compute_shader );
+    }
+
+    glLinkProgram( handle );
+
+    glGetProgramiv( handle, GL_LINK_STATUS, &link_status );
+    if (link_status == GL_FALSE)
+    {
+        GLchar messages[256];
+        glGetProgramInfoLog( handle, sizeof(messages), 0, &messages[0] );
+        fprintf( stderr, "%s\n", messages );
+    }
+    return handle;
+#endif
+}
+
 } //namespace ftdgl
@@ -9,4 +9,6 @@ typedef struct __attrib_map_s {
 } attrib_map_s;
 
 GLuint shader_load(const char * vert_source, const char * frag_source, uint32_t attrib_map_count = 0, attrib_map_s * attrib_map = nullptr);
+//needs GL 4.3
+GLuint shader_load_compute(const char * source);
 } //namespce ftdgl
@@ -0,0 +1,167 @@
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ftdgl {
+namespace util {
+namespace impl {
+class ThreadPoolImpl : public ThreadPool {
+public:
+    ThreadPoolImpl(size_t thread_count)
+        : m_Threads {}
+        , m_Lock {}
+        , m_Wake {}
+        , m_Done {}
+        , m_Task {nullptr}
+        , m_TaskCount {0}
+        , m_NextTask {0}
+        , m_FinishedTasks {0}
+        , m_ActiveWorkers {0}
+        , m_Generation {0}
+        , m_Stop {false}
+    {
+        Initialize(thread_count);
+    }
+
+    virtual ~ThreadPoolImpl() {
+        Cleanup();
+    }
+
+public:
+    virtual void Run(size_t count, const std::function<void(size_t)> & task);
+    virtual size_t GetThreadCount() const {
+        return m_Threads.size() + 1;
+    }
+
+private:
+    void Initialize(size_t thread_count);
+    void Cleanup();
+    void WorkerLoop();
+    void Work();
+
+    std::vector<std::thread> m_Threads;
+
+    std::mutex m_Lock;
+    std::condition_variable m_Wake;
+    std::condition_variable m_Done;
+
+    const std::function<void(size_t)> * m_Task;
+    size_t m_TaskCount;
+    std::atomic<size_t> m_NextTask;
+    std::atomic<size_t> m_FinishedTasks;
+    size_t m_ActiveWorkers;
+    uint64_t m_Generation;
+    bool m_Stop;
+};
+
+void ThreadPoolImpl::Initialize(size_t thread_count) {
+    if (thread_count == 0)
+        thread_count = std::thread::hardware_concurrency();
+
+    for(size_t i = 1; i < thread_count; i++) {
+        m_Threads.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+void ThreadPoolImpl::Cleanup() {
+    {
+        std::lock_guard<std::mutex> guard(m_Lock);
+        m_Stop = true;
+    }
+
+    m_Wake.notify_all();
+
+    for(auto & t : m_Threads) {
+        t.join();
+    }
+
+    m_Threads.clear();
+}
+
+void ThreadPoolImpl::Work() {
+    for(;;) {
+        size_t i = m_NextTask.fetch_add(1);
+
+        if (i >= m_TaskCount)
+            break;
+
+        (*m_Task)(i);
+
+        m_FinishedTasks.fetch_add(1);
+    }
+}
+
+void ThreadPoolImpl::WorkerLoop() {
+    uint64_t seen = 0;
+
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_Lock);
+
+            //only join a Run that is still in progress
+            m_Wake.wait(lock, [&] {
+                    return m_Stop || (m_Task && m_Generation != seen);
+                });
+
+            if (m_Stop)
+                return;
+
+            seen = m_Generation;
+            m_ActiveWorkers++;
+        }
+
+        Work();
+
+        {
+            std::lock_guard<std::mutex> guard(m_Lock);
+            m_ActiveWorkers--;
+        }
+
+        m_Done.notify_all();
+    }
+}
+
+void ThreadPoolImpl::Run(size_t count, const std::function<void(size_t)> & task) {
+    if (m_Threads.empty() || count < 2) {
+        for(size_t i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_Lock);
+
+        m_Task = &task;
+        m_TaskCount = count;
+        m_NextTask = 0;
+        m_FinishedTasks = 0;
+        m_Generation++;
+    }
+
+    m_Wake.notify_all();
+
+    Work();
+
+    std::unique_lock<std::mutex> lock(m_Lock);
+
+    //workers still inside Work may touch m_Task, wait them out too
+    m_Done.wait(lock, [&] {
+            return m_FinishedTasks == count && m_ActiveWorkers == 0;
+        });
+
+    m_Task = nullptr;
+}
+
+} //namespace impl
+
+ThreadPoolPtr CreateThreadPool(size_t thread_count) {
+    return std::make_shared<impl::ThreadPoolImpl>(thread_count);
+}
+
+} //namespace util
+} //namespace ftdgl
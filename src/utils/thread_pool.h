@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+#include <functional>
+
+namespace ftdgl {
+namespace util {
+class ThreadPool {
+public:
+    ThreadPool() = default;
+    virtual ~ThreadPool() = default;
+
+    //run task(0) .. task(count - 1) on the pool and the calling thread,
+    //return when all are done, one Run at a time per pool
+    virtual void Run(size_t count, const std::function<void(size_t)> & task) = 0;
+    //worker threads plus the calling thread
+    virtual size_t GetThreadCount() const = 0;
+};
+
+using ThreadPoolPtr = std::shared_ptr<ThreadPool>;
+
+//thread_count 0 means one thread per hardware thread
+ThreadPoolPtr CreateThreadPool(size_t thread_count);
+} //namespace util
+} //namespace ftdgl
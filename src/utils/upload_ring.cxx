@@ -0,0 +1,167 @@
+#include "upload_ring.h"
+
+#include "opengl.h"
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+namespace ftdgl {
+namespace util {
+#ifdef GL_MAP_PERSISTENT_BIT
+namespace impl {
+//region sizes are rounded up to this, also keeps region offsets aligned
+//for any vertex attribute
+constexpr size_t REGION_SIZE_STEP = 256;
+
+class UploadRingImpl : public UploadRing {
+public:
+    UploadRingImpl(size_t region_count)
+        : m_Buffer {0}
+        , m_Mapped {nullptr}
+        , m_RegionSize {0}
+        , m_Fences(region_count, nullptr)
+        , m_Region {0} {
+    }
+
+    virtual ~UploadRingImpl() {
+        Destroy();
+    }
+
+    virtual void * Map(size_t size);
+    virtual uint32_t GetBuffer() const { return m_Buffer; }
+    virtual size_t GetOffset() const { return m_Region * m_RegionSize; }
+
+private:
+    bool Resize(size_t region_size);
+    void Destroy();
+
+    GLuint m_Buffer;
+    uint8_t * m_Mapped;
+    size_t m_RegionSize;
+    //set when a region is left, until it is mapped again
+    std::vector<GLsync> m_Fences;
+    size_t m_Region;
+};
+
+void UploadRingImpl::Destroy() {
+    for(auto & fence : m_Fences) {
+        if (fence)
+            glDeleteSync(fence);
+
+        fence = nullptr;
+    }
+
+    //draws still reading the buffer keep it alive
+    if (m_Buffer) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_Buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &m_Buffer);
+    }
+
+    m_Buffer = 0;
+    m_Mapped = nullptr;
+    m_RegionSize = 0;
+}
+
+bool UploadRingImpl::Resize(size_t region_size) {
+    Destroy();
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    size_t size = region_size * m_Fences.size();
+
+    glGenBuffers(1, &m_Buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_Buffer);
+    glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+    m_Mapped = static_cast<uint8_t *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    if (!m_Mapped) {
+        std::cerr << "persistent map failed for " << size << " bytes" << std::endl;
+        glDeleteBuffers(1, &m_Buffer);
+        m_Buffer = 0;
+        return false;
+    }
+
+    m_RegionSize = region_size;
+    m_Region = 0;
+    return true;
+}
+
+void * UploadRingImpl::Map(size_t size) {
+    size = std::max<size_t>(size, 1);
+
+    if (size > m_RegionSize || !m_Buffer) {
+        if (!Resize((size + REGION_SIZE_STEP - 1) / REGION_SIZE_STEP * REGION_SIZE_STEP))
+            return nullptr;
+
+        return m_Mapped;
+    }
+
+    //everything reading the current region is queued by now
+    m_Fences[m_Region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_Region = (m_Region + 1) % m_Fences.size();
+
+    auto & fence = m_Fences[m_Region];
+
+    if (fence) {
+        //only waits when the gpu is region_count - 1 updates behind
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+
+        for(;;) {
+            GLenum result = glClientWaitSync(fence, flags, 1000000000);
+
+            if (result != GL_TIMEOUT_EXPIRED)
+                break;
+
+            flags = 0;
+        }
+
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    return m_Mapped + m_Region * m_RegionSize;
+}
+
+static
+bool has_buffer_storage() {
+    GLint major = 0, minor = 0;
+
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+    if (major > 4 || (major == 4 && minor >= 4))
+        return true;
+
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+    for(GLint i = 0; i < count; i++) {
+        auto name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+
+        if (name && !strcmp(name, "GL_ARB_buffer_storage"))
+            return true;
+    }
+
+    return false;
+}
+
+} //namespace impl
+#endif
+
+UploadRingPtr CreateUploadRing(size_t region_count) {
+#ifndef GL_MAP_PERSISTENT_BIT
+    (void)region_count;
+    return {};
+#else
+    if (region_count < 2 || !impl::has_buffer_storage())
+        return {};
+
+    return std::make_shared<impl::UploadRingImpl>(region_count);
+#endif
+}
+} //namespace util
+} //namespace ftdgl
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <memory>
+#include <cstdint>
+
+namespace ftdgl {
+namespace util {
+//a buffer split into regions written through one persistent coherent
+//mapping, Map moves on to the next region and only waits for the fence
+//the region got when it was left region_count - 1 maps ago, so new data
+//never waits for draws still reading the current region, call on the GL
+//thread only
+class UploadRing {
+public:
+    UploadRing() = default;
+    virtual ~UploadRing() = default;
+
+    //the next region of at least size bytes, the buffer changes when the
+    //regions grow, the region stays valid until the next Map
+    virtual void * Map(size_t size) = 0;
+    virtual uint32_t GetBuffer() const = 0;
+    //byte offset of the region of the last Map in the buffer
+    virtual size_t GetOffset() const = 0;
+};
+
+using UploadRingPtr = std::shared_ptr<UploadRing>;
+
+//empty without GL 4.4 or ARB_buffer_storage
+UploadRingPtr CreateUploadRing(size_t region_count = 3);
+} //namespace util
+} //namespace ftdgl
@@ -4,6 +4,14 @@
 
 namespace ftdgl {
 namespace viewport {
+//samples per pixel of the glyph accumulation, fewer samples draw each
+//glyph fewer times, gray tiers use a two channel texture
+enum antialias_e {
+    ANTIALIAS_LCD_6X = 0,
+    ANTIALIAS_GRAY_4X,
+    ANTIALIAS_GRAY_1X,
+};
+
 struct viewport_s {
     int width;
     int height;
@@ -11,6 +19,7 @@ struct viewport_s {
     float dpi_height;
     int line_height;//0 means using the font height
     int glyph_width;//0 means using the glyph advance x
+    int antialias;//antialias_e, 0 means 6x lcd subpixel
 };
 } //namespace viewport
 } //namespace ftdgl
@@ -1,6 +1,40 @@
 #include "font_manager.h"
+#include "glyph_pack.h"
+#include "text_layout.h"
+#include "text_layout_file.h"
+#include "paragraph.h"
 
-int main() {
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+static
+const
+char DEFAULT_FONT_FILE[] = "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf";
+
+static
+const
+char LAYOUT_FILE[] = "test_font_manager.layout";
+
+static
+const
+char PACK_FILE[] = "test_font_manager.pack";
+
+static
+const
+wchar_t TEXT[] = L"The quick brown fox\njumps over the lazy dog 0123456789";
+
+static
+bool check(bool ok, const char * what) {
+    if (!ok)
+        std::cerr << "failed:" << what << std::endl;
+
+    return ok;
+}
+
+#ifdef USE_FONTCONFIG
+static
+void create_fonts_from_desc() {
     ftdgl::FontManagerPtr fm = ftdgl::CreateFontManager(72, 72);
 
     fm->CreateFontFromDesc("Serif-12:lang=en:weight=200");
@@ -19,5 +53,199 @@ int main() {
     fm->CreateFontFromDesc("Monospace-12:lang=ko:weight=80");
     fm->CreateFontFromDesc("Monospace-12:lang=ja:weight=80");
     fm->CreateFontFromDesc("Monospace-12:lang=zh-CN:weight=80");
-    return 0;
+}
+#endif
+
+//lay out TEXT with a file font, save the layout and a pack of its glyphs,
+//then load both into a new font manager and compare
+static
+bool round_trip(const char * font_file) {
+    ftdgl::viewport::viewport_s viewport {640, 480, 72, 72, 0, 0, 0};
+    //fonts use the library of their manager, it has to outlive them
+    auto writer = ftdgl::CreateFontManager(viewport.dpi, viewport.dpi_height);
+    auto written = writer->CreateFontFromFile(font_file, 0, 16);
+
+    if (!check(!!written, "create font from file"))
+        return false;
+
+    auto layout = ftdgl::text::CreateTextLayout(viewport);
+
+    ftdgl::text::markup_s markup {{1, 1, 1, 1}, {0, 0, 0, 0}, written};
+    ftdgl::text::pen_s pen {10, 40};
+
+    if (!check(layout->AddText(pen, markup, TEXT), "add text")
+        || !check(ftdgl::text::SaveTextLayout(layout, viewport, LAYOUT_FILE), "save layout")
+        || !check(ftdgl::WriteGlyphPack({written}, viewport.dpi, viewport.dpi_height, PACK_FILE),
+                  "write glyph pack"))
+        return false;
+
+    auto fm = ftdgl::CreateFontManager(viewport.dpi, viewport.dpi_height);
+
+    if (!check(fm->LoadGlyphPack(PACK_FILE), "load glyph pack"))
+        return false;
+
+    //the layout file names the font by the description CreateFontFromFile
+    //gave it, loading opens the file again
+    auto loaded = ftdgl::text::LoadTextLayout(LAYOUT_FILE, viewport, fm);
+
+    if (!check(!!loaded, "load layout"))
+        return false;
+
+    auto font = fm->CreateFontFromDesc(written->GetDesc());
+
+    if (!check(!!font, "create packed font from file desc"))
+        return false;
+
+    bool ok = true;
+
+    //glyph ids may differ between the fonts, the glyphs of a codepoint
+    //have to match, the packed one taken from the pack
+    const auto & written_glyphs = written->GetGlyphTable();
+    const auto & glyphs = font->GetGlyphTable();
+
+    for(const wchar_t * c = TEXT; *c; c++) {
+        if (*c == L'\n')
+            continue;
+
+        auto written_id = written->LoadGlyphId(*c);
+        auto id = font->LoadGlyphId(*c);
+
+        if (!check(id != ftdgl::INVALID_GLYPH_ID, "packed glyph id")) {
+            ok = false;
+            continue;
+        }
+
+        ok = check(glyphs.Size(id) == written_glyphs.Size(written_id)
+                   && glyphs.AdvanceX(id) == written_glyphs.AdvanceX(written_id)
+                   && (!glyphs.Size(id)
+                       || !memcmp(glyphs.Addr(id), written_glyphs.Addr(written_id), glyphs.Size(id))),
+                   "packed glyph") && ok;
+    }
+
+    ok = check(layout->GetGlyphInstanceCount() > 0
+               && loaded->GetGlyphInstanceCount() == layout->GetGlyphInstanceCount(),
+               "instance count") && ok;
+    ok = check(loaded->GetFontCount() == 1 && loaded->GetFont(0) == font, "layout font") && ok;
+    ok = check(loaded->GetTextAttrCount() == layout->GetTextAttrCount(), "text attr count") && ok;
+
+    if (ok) {
+        const auto * a = layout->GetGlyphInstances();
+        const auto * b = loaded->GetGlyphInstances();
+
+        for(uint32_t i = 0; i < layout->GetGlyphInstanceCount(); i++) {
+            auto written_id = a[i].key & ftdgl::text::GLYPH_ID_MASK;
+            auto id = b[i].key & ftdgl::text::GLYPH_ID_MASK;
+
+            ok = check(a[i].x == b[i].x && a[i].y == b[i].y
+                       && id < glyphs.Count()
+                       && glyphs.Codepoint(id) == written_glyphs.Codepoint(written_id),
+                       "glyph instance") && ok;
+        }
+    }
+
+    remove(LAYOUT_FILE);
+    remove(PACK_FILE);
+    return ok;
+}
+
+static
+bool same_instances(ftdgl::text::TextLayoutPtr a, ftdgl::text::TextLayoutPtr b) {
+    a->Finish();
+    b->Finish();
+
+    if (a->GetGlyphInstanceCount() != b->GetGlyphInstanceCount())
+        return false;
+
+    const auto * x = a->GetGlyphInstances();
+    const auto * y = b->GetGlyphInstances();
+
+    for(uint32_t i = 0; i < a->GetGlyphInstanceCount(); i++) {
+        if (x[i].key != y[i].key || x[i].x != y[i].x || x[i].y != y[i].y)
+            return false;
+    }
+
+    return true;
+}
+
+//text long enough for the layout threads gives the same instances and
+//pen as laying it out on the calling thread
+static
+bool parallel_layout(const char * font_file) {
+    ftdgl::viewport::viewport_s viewport {640, 480, 72, 72, 0, 0, 0};
+    auto fm = ftdgl::CreateFontManager(viewport.dpi, viewport.dpi_height);
+    auto font = fm->CreateFontFromFile(font_file, 0, 13);
+
+    if (!check(!!font, "create font from file"))
+        return false;
+
+    ftdgl::text::markup_s markup {{1, 1, 1, 1}, {0, 0, 0, 0}, font};
+    std::wstring text;
+
+    while(text.length() < 64 * 1024) {
+        text += TEXT;
+        text += L'\n';
+    }
+
+    auto serial = ftdgl::text::CreateTextLayout(viewport);
+    auto parallel = ftdgl::text::CreateTextLayout(viewport);
+    ftdgl::text::pen_s serial_pen {10, 400};
+    ftdgl::text::pen_s parallel_pen {10, 400};
+
+    serial->SetLayoutThreads(1);
+    parallel->SetLayoutThreads(4);
+
+    bool ok = check(serial->AddText(serial_pen, markup, text), "serial layout");
+
+    ok = check(parallel->AddText(parallel_pen, markup, text), "parallel layout") && ok;
+    ok = check(serial_pen.x == parallel_pen.x && serial_pen.y == parallel_pen.y, "parallel layout pen") && ok;
+    ok = check(same_instances(serial, parallel), "parallel layout instances") && ok;
+
+    return ok;
+}
+
+//a paragraph lays text out as AddText does when it does not wrap,
+//including line breaks at its start
+static
+bool paragraph_breaks(const char * font_file) {
+    ftdgl::viewport::viewport_s viewport {640, 480, 72, 72, 0, 0, 0};
+    auto fm = ftdgl::CreateFontManager(viewport.dpi, viewport.dpi_height);
+    auto font = fm->CreateFontFromFile(font_file, 0, 16);
+
+    if (!check(!!font, "create font from file"))
+        return false;
+
+    ftdgl::text::markup_s markup {{1, 1, 1, 1}, {0, 0, 0, 0}, font};
+    bool ok = true;
+
+    for(const wchar_t * text : {L"abc", L"\nabc", L"\n\nabc", L"ab\n\ncd\n"}) {
+        auto paragraph = ftdgl::text::CreateParagraph(viewport);
+        auto expected = ftdgl::text::CreateTextLayout(viewport);
+        auto layout = ftdgl::text::CreateTextLayout(viewport);
+        ftdgl::text::pen_s pen {10, 400};
+
+        expected->AddText(pen, markup, text);
+
+        paragraph->AddText(markup, text);
+        paragraph->Layout(viewport.width);
+        pen = {10, 400};
+        paragraph->AddToLayout(layout, pen);
+
+        ok = check(same_instances(expected, layout), "paragraph line breaks") && ok;
+    }
+
+    return ok;
+}
+
+int main(int argc, char ** argv) {
+#ifdef USE_FONTCONFIG
+    create_fonts_from_desc();
+#endif
+
+    const char * font_file = argc > 1 ? argv[1] : DEFAULT_FONT_FILE;
+    bool ok = round_trip(font_file);
+
+    ok = paragraph_breaks(font_file) && ok;
+    ok = parallel_layout(font_file) && ok;
+
+    return ok ? 0 : 1;
 }
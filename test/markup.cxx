@@ -67,10 +67,18 @@ void init(const ftdgl::viewport::viewport_s & viewport)
     ftdgl::text::pen_s pen = {40, 250};
 
     (void)none;
-    buffer->AddText(pen, normal, L"The");
-    buffer->AddText(pen, normal,    L" Quick");
-    buffer->AddText(pen, big,       L" brown ");
-    buffer->AddText(pen, reverse,   L" fox \n"); pen.x = 20;
+    uint32_t s_normal  = buffer->AddStyle(normal);
+    uint32_t s_big     = buffer->AddStyle(big);
+    uint32_t s_reverse = buffer->AddStyle(reverse);
+
+    ftdgl::text::text_run_s runs[] = {
+        {s_normal,  L"The", 3},
+        {s_normal,  L" Quick", 6},
+        {s_big,     L" brown ", 7},
+        {s_reverse, L" fox \n", 6},
+    };
+
+    buffer->AddRuns(pen, runs, sizeof(runs) / sizeof(ftdgl::text::text_run_s)); pen.x = 20;
     buffer->AddText(pen, italic,    L"jumps over ");
     buffer->AddText(pen, bold,      L"the lazy ");
     buffer->AddText(pen, normal,    L"dog.\n"); pen.x = 20;
@@ -106,7 +114,8 @@ void setup(GLFWwindow* window) {
     ftdgl::viewport::viewport_s viewport {
         pixel_width, pixel_height,
         dpi, dpi_height,
-        0, 0
+        0, 0,
+        ftdgl::viewport::ANTIALIAS_LCD_6X
     };
 
     init(viewport);
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "font_manager.h"
+#include "glyph_pack.h"
+
+//printable ascii when a font lists no range
+static const uint32_t DEFAULT_FIRST = 0x20;
+static const uint32_t DEFAULT_LAST = 0x7E;
+//points of a font file without -s
+static const double DEFAULT_SIZE = 12;
+
+typedef struct __range_s {
+    uint32_t first;
+    uint32_t last;
+} range_s;
+
+//a fontconfig description, or a font file when path is set
+typedef struct __pack_font_s {
+    std::string desc;
+    std::string path;
+    int index;
+    double size;
+    std::vector<range_s> ranges;
+} pack_font_s;
+
+static
+void usage(const char * name)
+{
+    fprintf(stderr,
+            "usage: %s [-d dpi] [-D dpi_height] -o pack_file\n"
+            "       (-f font_desc | -F font_file[:index] [-s size]) [-r first[-last]]...\n"
+            "       [(-f font_desc | -F font_file[:index] [-s size]) [-r first[-last]]...]...\n"
+            "\n"
+            "compile the glyphs of each font in its codepoint ranges into pack_file,\n"
+            "-f matches a description with fontconfig, -F opens face index of a\n"
+            "font file at size points as FontManager::CreateFontFromFile does,\n"
+            "index defaults to 0 and size to %g,\n"
+            "codepoints are decimal or 0x hex, fonts without -r get %#x-%#x,\n"
+            "dpi defaults to 72 and dpi_height to dpi\n",
+            name, DEFAULT_SIZE, DEFAULT_FIRST, DEFAULT_LAST);
+}
+
+static
+bool parse_range(const char * text, range_s & range)
+{
+    char * end = nullptr;
+
+    range.first = strtoul(text, &end, 0);
+
+    if (end == text)
+        return false;
+
+    range.last = range.first;
+
+    if (*end == '-') {
+        const char * last = end + 1;
+
+        range.last = strtoul(last, &end, 0);
+
+        if (end == last)
+            return false;
+    }
+
+    return *end == 0 && range.first <= range.last;
+}
+
+//path[:index], a path that itself ends in :digits needs the index given
+static
+bool parse_font_file(const char * text, pack_font_s & font)
+{
+    std::string value = text;
+    size_t colon = value.rfind(':');
+
+    font.path = value;
+    font.index = 0;
+    font.size = DEFAULT_SIZE;
+
+    if (colon == std::string::npos || colon + 1 == value.size())
+        return !value.empty();
+
+    const char * index = text + colon + 1;
+    char * end = nullptr;
+    long v = strtol(index, &end, 10);
+
+    if (*end != 0 || v < 0)
+        return true;
+
+    font.path = value.substr(0, colon);
+    font.index = static_cast<int>(v);
+    return !font.path.empty();
+}
+
+int main( int argc, char **argv )
+{
+    float dpi = 72;
+    float dpi_height = 0;
+    const char * output = nullptr;
+    std::vector<pack_font_s> fonts;
+
+    for(int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        const char * arg = argv[i];
+        const char * value = argv[++i];
+
+        if (!strcmp(arg, "-d")) {
+            dpi = atof(value);
+        } else if (!strcmp(arg, "-D")) {
+            dpi_height = atof(value);
+        } else if (!strcmp(arg, "-o")) {
+            output = value;
+        } else if (!strcmp(arg, "-f")) {
+            fonts.push_back({value, "", 0, 0, {}});
+        } else if (!strcmp(arg, "-F")) {
+            pack_font_s font {value, "", 0, 0, {}};
+
+            if (!parse_font_file(value, font)) {
+                fprintf(stderr, "bad font file:%s\n", value);
+                return 1;
+            }
+
+            fonts.push_back(font);
+        } else if (!strcmp(arg, "-s") && !fonts.empty() && !fonts.back().path.empty()) {
+            fonts.back().size = atof(value);
+
+            if (fonts.back().size <= 0) {
+                fprintf(stderr, "bad font size:%s\n", value);
+                return 1;
+            }
+        } else if (!strcmp(arg, "-r") && !fonts.empty()) {
+            range_s range;
+
+            if (!parse_range(value, range)) {
+                fprintf(stderr, "bad codepoint range:%s\n", value);
+                return 1;
+            }
+
+            fonts.back().ranges.push_back(range);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!output || fonts.empty() || dpi <= 0 || dpi_height < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (dpi_height == 0)
+        dpi_height = dpi;
+
+    auto font_manager = ftdgl::CreateFontManager(dpi, dpi_height);
+    std::vector<ftdgl::FontPtr> loaded;
+
+    for(auto & font : fonts) {
+        //a file font gets the description the runtime looks the pack up by
+        auto f = font.path.empty()
+                ? font_manager->CreateFontFromDesc(font.desc)
+                : font_manager->CreateFontFromFile(font.path, font.index, font.size);
+
+        if (!f) {
+            fprintf(stderr, "no font for:%s\n", font.desc.c_str());
+            return 1;
+        }
+
+        if (font.ranges.empty())
+            font.ranges.push_back({DEFAULT_FIRST, DEFAULT_LAST});
+
+        size_t count = 0;
+
+        for(const auto & range : font.ranges) {
+            //64 bits so a range may end at the largest codepoint
+            for(uint64_t codepoint = range.first; codepoint <= range.last; codepoint++) {
+                //chars no font has would all be packed as the missing glyph
+                if (!f->HasGlyph(codepoint))
+                    continue;
+
+                if (f->LoadGlyphId(codepoint) != ftdgl::INVALID_GLYPH_ID)
+                    count++;
+            }
+        }
+
+        std::cout << f->GetDesc() << ":" << count << " glyphs" << std::endl;
+
+        //descriptions matching an earlier font share its glyphs
+        if (std::find(loaded.begin(), loaded.end(), f) == loaded.end())
+            loaded.push_back(f);
+    }
+
+    if (!ftdgl::WriteGlyphPack(loaded, dpi, dpi_height, output))
+        return 1;
+
+    return 0;
+}